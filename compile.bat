@@ -1,7 +1,11 @@
 @echo off
 set include_folder="../../include"
 set libraries_folder="../../libraries/"
+rem set to --compact for half float positions and packed normals
+set meshconv_flags=
 
 @echo on
+g++ meshconv.cpp -o meshconv
+for %%f in (meshes\*.obj) do meshconv %meshconv_flags% "%%f" "meshes\%%~nf.mesh"
 g++ main.cpp ./../../source/glad.c ./../../libraries/** -o out -I %include_folder% -L %libraries_folder% -lglfw3dll -lopengl32 -mwindows
 start "" "./out.exe"
\ No newline at end of file
@@ -4,492 +4,5413 @@
 #include <GLFW/glfw3.h>
 
 #define _USE_MATH_DEFINES
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
 #include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define HAVE_SSE 1
+#include <xmmintrin.h>
+#endif
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/quaternion.hpp>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
-GLuint CreateShaderProgram(const std::string& vertexShaderFilePath, const std::string& fragmentShaderFilePath);
-GLuint CreateShaderFromFile(const GLuint& shaderType, const std::string& shaderFilePath);
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "meshformat.h"
+
+// a list of "NAME" or "NAME VALUE" entries, each becomes a #define right after the #version line
+typedef std::vector<std::string> ShaderDefines;
+
+GLuint CreateShaderFromFile(const GLuint& shaderType, const std::string& shaderFilePath, const ShaderDefines& defines = {});
 GLuint CreateShaderFromSource(const GLuint& shaderType, const std::string& shaderSource);
+// starts compiling without waiting for the result, see CheckShaderCompileStatus
+GLuint SubmitShaderSource(const GLuint& shaderType, const std::string& shaderSource);
+bool CheckShaderCompileStatus(GLuint shader);
+std::string InsertShaderDefines(const std::string& shaderSource, const ShaderDefines& defines);
+bool ReadShaderFile(const std::string& shaderFilePath, std::string& shaderSource);
 
-void FramebufferSizeChangedCallback(GLFWwindow* window, int width, int height);
+// PROGRAM BINARY CACHE
+// linked programs are stored here keyed on their sources and the driver, so later launches skip compiling
+const std::string PROGRAM_BINARY_CACHE_DIRECTORY = "shadercache";
+bool ProgramBinariesSupported();
+std::string ProgramBinaryCachePath(const std::vector<std::string>& shaderSources);
+GLuint LoadProgramBinary(const std::string& cachePath);
+void SaveProgramBinary(GLuint program, const std::string& cachePath);
+uint64_t HashString(const std::string& value, uint64_t hash = 14695981039346656037ull);
+
+// PARALLEL SHADER COMPILATION
+// with KHR_parallel_shader_compile the driver compiles on its own threads and
+// GL_COMPLETION_STATUS_KHR can be polled without blocking
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+bool parallelShaderCompileSupported = false;
+void InitParallelShaderCompile();
+
+void BindInstanceAttributes(GLuint firstInstance);
+
+// depth texture array with one layer per cascade
+GLuint CreateShadowMapArray(GLuint width, GLuint height);
 
-struct Vertex
+// MOMENT SHADOWS
+// exponent of the EVSM warp, exp(2 * EVSM_EXPONENT) has to stay within 32-bit float range
+const GLfloat EVSM_EXPONENT = 40.0f;
+// texels past the rendered part of a scaled-down cascade that the moments pass fills with its edge,
+// which keeps the first five mips from averaging in the unrendered rest of the layer
+const GLuint MOMENTS_GUARD_TEXELS = 32;
+// RG32F texture array for blurred shadow moments, with a full mip chain if mipmapped
+GLuint CreateMomentsArray(GLuint width, GLuint height, GLuint layers, bool mipmapped);
+
+// true only on the frame the key goes down
+bool KeyPressedOnce(GLFWwindow* window, int key, bool& wasPressed);
+
+void ComputeShadowCascades(const glm::mat4& viewMatrix, GLfloat fieldOfView, GLfloat aspectRatio, GLfloat nearPlane,
+	const glm::vec3& lightDirection, GLuint shadowMapResolution, glm::mat4* lightViewProjections, GLfloat* cascadeSplits);
+
+// STATIC SHADOW CACHE
+// every cascade keeps its static casters in a layer of its own, covering STATIC_SHADOW_CACHE_SCALE times the cascade's
+// extent at the cascade's texel size and on its snapped texel grid. a layer is only re-rendered once its cascade leaves
+// that window, every frame shadowcache.fsh copies it into the cascade before the dynamic casters are drawn on top
+const GLuint STATIC_SHADOW_CACHE_SCALE = 2;
+// the window around the cascade's current light-space box, centered on it
+glm::mat4 ComputeStaticShadowWindow(const glm::mat4& cascadeViewProjection);
+// true while the cascade's light-space box lies inside the window and still has the window's texel size
+bool StaticShadowWindowCovers(const glm::mat4& windowViewProjection, const glm::mat4& cascadeViewProjection);
+
+// GL STATE CACHE
+// last program, VAO, buffers and textures bound through it, so the render loop can skip binds that change nothing.
+// anything bound behind its back, like the setup code or glBindBufferBase, needs InvalidateGlStateCache afterwards
+const GLuint UNKNOWN_BINDING = ~0u;
+const GLuint STATE_CACHE_TEXTURE_UNITS = 16;
+struct GlStateCache
 {
-	GLfloat x, y, z;	  // Position
-	GLubyte r, g, b;		// Color
-	GLfloat nx, ny, nz;	// Normals
+	GLuint program;
+	GLuint vertexArray;
+	GLuint arrayBuffer;
+	GLuint uniformBuffer;
+	GLuint shaderStorageBuffer;
+	GLuint drawIndirectBuffer;
+	GLuint activeTextureUnit;
+	GLuint textures[STATE_CACHE_TEXTURE_UNITS];
+	GLenum textureTargets[STATE_CACHE_TEXTURE_UNITS];
 };
 
+void InvalidateGlStateCache(GlStateCache& state);
+void UseProgram(GlStateCache& state, GLuint program);
+// also forgets the element array buffer, which belongs to the VAO
+void BindVertexArray(GlStateCache& state, GLuint vertexArray);
+// targets without a cache entry are always bound
+void BindBuffer(GlStateCache& state, GLenum target, GLuint buffer);
+// glBindBufferRange also replaces the target's generic binding, which the cache has to know about
+void BindBufferRange(GlStateCache& state, GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+void BindTexture(GlStateCache& state, GLuint unit, GLenum target, GLuint texture);
+// deleting a buffer resets every binding of it to 0, the cache has to follow or it would skip rebinding a reused name
+void DeleteBuffer(GlStateCache& state, GLuint buffer);
 
-int main()
+// STREAMING BUFFERS
+// one buffer split into a region per frame in flight. the CPU writes the current region through a persistent coherent
+// mapping while the GPU still reads the older ones, and each region is fenced when its frame has been submitted and
+// waited on before it is written again. without GL 4.4 or ARB_buffer_storage the regions are written with
+// glBufferSubData and the whole buffer is orphaned whenever the first region comes around again
+const int STREAM_FRAME_REGIONS = 3;
+// how long a single glClientWaitSync waits before checking again, in nanoseconds
+const GLuint64 STREAM_FENCE_TIMEOUT = 1000000;
+struct StreamBuffer
 {
-	// Initialize GLFW
-	int glfwInitStatus = glfwInit();
-	if (glfwInitStatus == GLFW_FALSE)
-	{
-		std::cerr << "Failed to initialize GLFW!" << std::endl;
-		return 1;
-	}
+	GLuint buffer = 0;
+	GLsizeiptr regionSize = 0;	// a multiple of alignment
+	GLsizeiptr alignment = 1;	// of every offset handed out, the binding's offset alignment or the vertex stride
+	int region = 0;
+	GLsizeiptr offset = 0;	// write head within the current region
+	bool persistent = false;
+	uint8_t* mapped = nullptr;
+	GLsync fences[STREAM_FRAME_REGIONS] = {};
+};
 
-	// Tell GLFW that we prefer to use OpenGL 3.3
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+bool CreateStreamBuffer(StreamBuffer& stream, GLsizeiptr regionSize, GLsizeiptr alignment);
+void DeleteStreamBuffer(GlStateCache& state, StreamBuffer& stream);
+// moves to the next region, first waiting for the GPU to finish the frame that used it last
+void BeginStreamFrame(StreamBuffer& stream);
+// fences the current region, once every command reading this frame's data has been issued
+void EndStreamFrame(StreamBuffer& stream);
+// waits until the GPU passed the fence, then deletes it, does nothing without one
+void WaitForStreamFence(GLsync& fence);
+// copies data into the current region and returns its offset in the buffer, or -1 if it doesn't fit.
+// a region too small for the frame's first write grows the whole buffer, which may change its name
+GLintptr StreamData(GlStateCache& state, StreamBuffer& stream, const void* data, GLsizeiptr size);
+// streams data and binds its range to an indexed uniform or shader storage binding
+bool StreamBufferRange(GlStateCache& state, StreamBuffer& stream, GLenum target, GLuint index, const void* data, GLsizeiptr size);
 
-	// Tell GLFW that we prefer to use the modern OpenGL
-	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GLFW_TRUE);
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+// index into ShaderProgram::uniforms, resolved once so per-draw setters skip the name lookup
+typedef int UniformHandle;
+const UniformHandle NO_UNIFORM = -1;	// inactive, setting it does nothing like location -1
 
-	// Tell GLFW to create a window
-	float windowWidth = 800;
-	float windowHeight = 800;
-	GLFWwindow* window = glfwCreateWindow(windowWidth, windowHeight, "Shadow Mapping 👻", nullptr, nullptr);
-	if (window == nullptr)
+// shader program with every active uniform looked up once at link time
+struct ShaderProgram
+{
+	struct Uniform
 	{
-		std::cerr << "Failed to create GLFW window!" << std::endl;
-		glfwTerminate();
-		return 1;
-	}
+		std::string name;
+		GLint location;
+		GLenum type;
+		GLint size;
+		std::vector<unsigned char> lastValue;	// empty until the first upload
+	};
 
-	// Tell GLFW to use the OpenGL context that was assigned to the window that we just created
-	glfwMakeContextCurrent(window);
+	GLuint id = 0;
+	// a program has a few dozen uniforms at most, so finding one by name is a linear scan
+	std::vector<Uniform> uniforms;
+	// set per object by the non-instanced path, resolved by CacheActiveUniforms
+	struct ObjectUniforms
+	{
+		UniformHandle model = NO_UNIFORM;
+		UniformHandle normalMatrix = NO_UNIFORM;
+		UniformHandle material = NO_UNIFORM;
+		UniformHandle textureLayer = NO_UNIFORM;
+	};
+	ObjectUniforms objectUniforms;
 
-	// Register the callback function that handles when the framebuffer size has changed
-	glfwSetFramebufferSizeCallback(window, FramebufferSizeChangedCallback);
+	// build state, programs are submitted without waiting and finished on first use
+	bool ready = false;
+	std::vector<GLuint> pendingShaders;	// still attached until the link result is checked
+	std::string binaryCachePath;		// where to store the binary once linked, empty to skip
 
-	// Tell GLAD to load the OpenGL function pointers
-	if (!gladLoadGLLoader(reinterpret_cast<GLADloadproc>(glfwGetProcAddress)))
-	{
-		std::cerr << "Failed to initialize GLAD!" << std::endl;
-		return 1;
-	}
+	// finishes the build first if it is still pending, and binds through the cache so it stays in sync
+	void Use(GlStateCache& state);
 
-	// vertex specification
-	// 							Position									Color
-
-	Vertex vertices[28];
-
-	// CUBE
-	// front
-	vertices[0] = { -0.5f, 0.5f, 0.5f,        255, 0, 0 };
-	vertices[1] = { 0.5f, 0.5f, 0.5f,         255, 0, 0 };
-	vertices[2] = { 0.5f, -0.5f, 0.5f,        255, 0, 0 };
-	vertices[3] = { -0.5f, -0.5f, 0.5f,       255, 0, 0 };
-
-	// back
-	vertices[4] = { 0.5f, 0.5f, -0.5f,        0, 255, 0 };
-	vertices[5] = { -0.5f, 0.5f, -0.5f,       0, 255, 0 };
-	vertices[6] = { -0.5f, -0.5f, -0.5f,      0, 255, 0 };
-	vertices[7] = { 0.5f, -0.5f, -0.5f,     	0, 255, 0 };
-
-	// left
-	vertices[8] = { -0.5f, 0.5f, -0.5f,    	  0, 0, 255 };
-	vertices[9] = { -0.5f, 0.5f, 0.5f,        0, 0, 255 };
-	vertices[10] = { -0.5f, -0.5f, 0.5f,      0, 0, 255 };
-	vertices[11] = { -0.5f, -0.5f, -0.5f,     0, 0, 255 };
-
-	// right
-	vertices[12] = { 0.5f, 0.5f, 0.5f,     		255, 255, 0 };
-	vertices[13] = { 0.5f, 0.5f, -0.5f,       255, 255, 0 };
-	vertices[14] = { 0.5f, -0.5f, -0.5f,      255, 255, 0 };
-	vertices[15] = { 0.5f, -0.5f, 0.5f,      	255, 255, 0 };
-
-	// top
-	vertices[16] = { -0.5f, 0.5f, -0.5f,      255, 0, 255 };
-	vertices[17] = { 0.5f, 0.5f, -0.5f,       255, 0, 255 };
-	vertices[18] = { 0.5f, 0.5f, 0.5f,    	  255, 0, 255 };
-	vertices[19] = { -0.5f, 0.5f, 0.5f,     	255, 0, 255 };
-
-	// bottom
-	vertices[20] = { -0.5f, -0.5f, 0.5f,      0, 255, 255 };
-	vertices[21] = { 0.5f, -0.5f, 0.5f,       0, 255, 255 };
-	vertices[22] = { 0.5f, -0.5f, -0.5f,      0, 255, 255 };
-	vertices[23] = { -0.5f, -0.5f, -0.5f,     0, 255, 255 };
-	
-	// PLANE that faces upwards
-	vertices[24] = { -0.5f, 0.5f, -0.5f,      250, 250, 250 };
-	vertices[25] = { 0.5f, 0.5f, -0.5f,       250, 250, 250 };
-	vertices[26] = { 0.5f, 0.5f, 0.5f,    	  250, 250, 250 };
-	vertices[27] = { -0.5f, 0.5f, 0.5f,     	250, 250, 250 };
-
-	// normals
-	for(int i = 0; i < 28; i += 4) {
-		GLfloat x0 = vertices[i].x;
-		GLfloat y0 = vertices[i].y;
-		GLfloat z0 = vertices[i].z;
-
-		GLfloat x1 = vertices[i + 1].x;
-		GLfloat y1 = vertices[i + 1].y;
-		GLfloat z1 = vertices[i + 1].z;
-		
-		GLfloat x2 = vertices[i + 2].x;
-		GLfloat y2 = vertices[i + 2].y;
-		GLfloat z2 = vertices[i + 2].z;
-
-		GLfloat v0x = x2 - x0;
-		GLfloat v0y = y2 - y0;
-		GLfloat v0z = z2 - z0;
-
-		GLfloat v1x = x1 - x0;
-		GLfloat v1y = y1 - y0;
-		GLfloat v1z = z1 - z0;
-
-		glm::vec3 normal;
-		normal = glm::cross(glm::vec3(v0x, v0y, v0z), glm::vec3(v1x, v1y, v1z));
-
-		vertices[i].nx = normal.x;
-		vertices[i].ny = normal.y;
-		vertices[i].nz = normal.z;
-		vertices[i + 1].nx = normal.x;
-		vertices[i + 1].ny = normal.y;
-		vertices[i + 1].nz = normal.z;
-		vertices[i + 2].nx = normal.x;
-		vertices[i + 2].ny = normal.y;
-		vertices[i + 2].nz = normal.z;
-		vertices[i + 3].nx = normal.x;
-		vertices[i + 3].ny = normal.y;
-		vertices[i + 3].nz = normal.z;
-	}
-	
-	// vertex order for EBO
-	GLuint cubeIndices[] = {
-		0,1,2,    0,2,3,
-		4,5,6,    4,6,7,
-		8,9,10,   8,10,11,
-		12,13,14, 12,14,15,
-		16,17,18, 16,18,19,
-		20,21,22, 20,22,23
-	};
+	UniformHandle FindUniform(const char* name) const;
 
-	GLuint planeIndices[] = {
-		24,25,26, 24,26,27
-	};
+	// setters expect the program to be in use, and skip the upload when the value hasn't changed.
+	// by name for per-frame setup, by handle inside per-draw loops
+	void SetInt(const char* name, GLint value);
+	void SetFloat(const char* name, GLfloat value);
+	void SetVec2(const char* name, const glm::vec2& value);
+	void SetVec4(const char* name, const glm::vec4& value);
+	void SetMat3(const char* name, const glm::mat3& value);
+	void SetMat4(const char* name, const glm::mat4& value);
+	void SetInt(UniformHandle handle, GLint value);
+	void SetFloat(UniformHandle handle, GLfloat value);
+	void SetVec2(UniformHandle handle, const glm::vec2& value);
+	void SetVec4(UniformHandle handle, const glm::vec4& value);
+	void SetMat3(UniformHandle handle, const glm::mat3& value);
+	void SetMat4(UniformHandle handle, const glm::mat4& value);
 
-	// VBO setup
-	GLuint vbo;
-	glGenBuffers(1, &vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	Uniform* FindChangedUniform(UniformHandle handle, const void* value, size_t valueSize);
+};
 
-	// EBO setup
-	GLuint cubeEbo;
-	glGenBuffers(1, &cubeEbo);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeEbo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(cubeIndices), cubeIndices, GL_STATIC_DRAW);
+void CacheActiveUniforms(ShaderProgram& program);
 
-	GLuint planeEbo;
-	glGenBuffers(1, &planeEbo);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, planeEbo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(planeIndices), planeIndices, GL_STATIC_DRAW);
-	
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+// non-blocking build: submit compiles and the link, poll for completion, then finish.
+// the geometry shader is optional, pass an empty path to leave it out
+void SubmitShaderProgram(ShaderProgram& program, const std::string& vertexShaderFilePath, const std::string& fragmentShaderFilePath,
+	const std::string& geometryShaderFilePath = "", const ShaderDefines& defines = {});
+// same for a compute program, needs GL 4.3
+void SubmitComputeProgram(ShaderProgram& program, const std::string& computeShaderFilePath, const ShaderDefines& defines = {});
+// never blocks, always false without KHR_parallel_shader_compile
+bool IsShaderProgramBuildComplete(const ShaderProgram& program);
+// blocks until the build is done, reports errors, stores the binary and caches uniforms
+void FinishShaderProgram(ShaderProgram& program);
 
-	// VAO setup
-	GLuint vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, x));
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*)(offsetof(Vertex, r)));
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(offsetof(Vertex, nx)));
-	glBindVertexArray(0);
+// every compiled permutation, keyed by its shader files and defines
+struct ShaderPermutationCache
+{
+	ShaderDefines globalDefines;	// added to every permutation
+	std::unordered_map<std::string, ShaderProgram> programs;
+};
 
-	// FBO setup
-	GLuint fbo;
-	glGenFramebuffers(1, &fbo);
-	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+// returns the cached program for these files and defines, submitting its build on first request.
+// references stay valid until DeleteShaderPermutations
+ShaderProgram& GetShaderPermutation(ShaderPermutationCache& cache, const std::string& vertexShaderFilePath,
+	const std::string& fragmentShaderFilePath, const std::string& geometryShaderFilePath, ShaderDefines defines);
+// finishes every permutation whose build has completed in the background
+void PollShaderPermutations(ShaderPermutationCache& cache);
+void DeleteShaderPermutations(ShaderPermutationCache& cache);
 
-	// Depth Texture
-	GLuint depthTexture;
-	GLuint depthTextureWidth = 1024;
-	GLuint depthTextureHeight = 1024;
-	glGenTextures(1, &depthTexture);
-	glBindTexture(GL_TEXTURE_2D, depthTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, depthTextureWidth, depthTextureHeight, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_BYTE, nullptr);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+void FramebufferSizeChangedCallback(GLFWwindow* window, int width, int height);
 
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
-	glDrawBuffer(GL_NONE);
+// per-instance data streamed to the instanced shaders
+struct InstanceData
+{
+	glm::mat4 model;			// Model matrix
+	glm::vec4 normalMatrix[3];	// inverse transpose of the model's upper 3x3, columns padded to vec4
+	glm::vec4 material;			// rgb tints the vertex color, a is the specular exponent
+	glm::vec4 textureParams;	// x is the material's layer in the material texture array, yzw are unused
+};
 
-	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-	{
-		printf("Framebuffer incomplete...");
-		return 1;
-	}
+// instance attributes start right after the vertex attributes
+const GLuint INSTANCE_ATTRIBUTE_LOCATION = 3;
+const GLuint NORMAL_MATRIX_ATTRIBUTE_LOCATION = INSTANCE_ATTRIBUTE_LOCATION + 4;
+const GLuint MATERIAL_ATTRIBUTE_LOCATION = NORMAL_MATRIX_ATTRIBUTE_LOCATION + 3;
+const GLuint TEXTURE_LAYER_ATTRIBUTE_LOCATION = MATERIAL_ATTRIBUTE_LOCATION + 1;
+const GLuint INSTANCE_ATTRIBUTE_COUNT = TEXTURE_LAYER_ATTRIBUTE_LOCATION + 1 - INSTANCE_ATTRIBUTE_LOCATION;
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+glm::mat3 NormalMatrixOf(const InstanceData& instance);
 
-	GLuint mainShader = CreateShaderProgram("main.vsh", "main.fsh");
-	GLuint depthShader = CreateShaderProgram("depth.vsh", "depth.fsh");
+// scene object transforms, one array per component so the update kernel can work on 4 objects at a time
+struct TransformStore
+{
+	std::vector<float> positionX, positionY, positionZ;
+	std::vector<float> rotationX, rotationY, rotationZ, rotationW;
+	std::vector<float> scaleX, scaleY, scaleZ;
+	std::vector<uint8_t> dirty;
 
-	// glViewport(0, 0, windowWidth, windowHeight);
+	size_t Add(const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale);
+	void SetPosition(size_t index, const glm::vec3& position);
+	void SetRotation(size_t index, const glm::quat& rotation);
+	void SetScale(size_t index, const glm::vec3& scale);
+	size_t Size() const { return dirty.size(); }
+};
 
-	glEnable(GL_DEPTH_TEST);
+// writes world = T * S * R and its normal matrix into instances for every dirty transform in [first, last),
+// then clears their flags. ranges starting at a multiple of 4 can be updated concurrently
+void UpdateWorldMatrices(TransformStore& transforms, InstanceData* instances, size_t first = 0, size_t last = SIZE_MAX);
 
-	
-	GLint cubeIndicesSize = sizeof(cubeIndices) / sizeof(cubeIndices[0]);
-	GLint planeIndicesSize = sizeof(planeIndices) / sizeof(planeIndices[0]);
+// scene description, read from SCENE_FILE at startup
+const char* const SCENE_FILE = "scene.txt";
 
-	// camera and movement
-	GLfloat horizontalAngle = M_PI;
-	GLfloat verticalAngle = 0.0f;
-	GLfloat speed = 4.0f;
-	GLfloat mouseSpeed = 0.8f;
-	glm::vec3 direction, right, up;
+struct Material
+{
+	std::string name;
+	glm::vec3 color;
+	GLfloat shininess;
+	std::string texture;	// image file, empty for an untextured material
+	GLuint textureLayer;	// in the material texture array, materials sharing an image share its layer
+};
 
-	// starting view position
-	glm::vec3 position(0.0f, 3.0f, 5.0f);
-	GLdouble xpos, ypos;
+struct SceneObject
+{
+	std::string mesh;
+	std::string material;
+	glm::vec3 position;
+	glm::quat rotation;
+	glm::vec3 scale;
+	// objects with a spin are animated and drawn as dynamic shadow casters
+	glm::vec3 spinAxis;
+	GLfloat spinSpeed;	// degrees per second
+};
 
-	GLfloat lastTime = glfwGetTime();
+struct SceneMesh
+{
+	std::string name;
+	std::string path;	// .mesh file written by meshconv
+};
 
-	// DIRECTIONAL LIGHT
-	glm::vec3 directionalLightPosition(3.0f, 3.0f, -7.0f);
-	glm::vec3 directionalLightDirection(-1.0f, -1.0f, 1.0f);
-	glm::vec3 directionalLightAmbient(1.0f, 1.0f, 1.0f);
-	glm::vec3 directionalLightDiffuse(0.75f, 0.75f, 0.75f);
-	glm::vec3 directionalLightSpecular(0.5f, 0.5f, 0.5f);
-	glm::mat4 directionalLightProjectionMatrix = glm::ortho(-15.0f, 10.0f, -5.0f, 10.0f, 0.0f, 20.0f);
-	glm::mat4 directionalLightViewMatrix = glm::lookAt(directionalLightPosition, directionalLightPosition + directionalLightDirection, glm::vec3(0, 1, 0));
+// values match the light type constants in main.fsh
+enum LightType : GLint
+{
+	LIGHT_POINT = 0,
+	LIGHT_DIRECTIONAL = 1,
+	LIGHT_SPOT = 2,
+};
 
-	// Render loop
-	while (!glfwWindowShouldClose(window))
-	{
-		GLfloat currentTime = glfwGetTime();
-		GLfloat deltaTime = currentTime - lastTime;
-		lastTime = currentTime;
+// local light, lit by the clustered path and optionally shadowed through the shadow atlas
+struct SceneLight
+{
+	LightType type;
+	glm::vec3 position;
+	glm::vec3 direction;	// spot lights only
+	glm::vec3 color;
+	GLfloat range;	// the light fades out to nothing here
+	GLfloat innerAngle, outerAngle;	// radians from the axis, spot lights only
+	bool castsShadow;
+};
+
+struct Scene
+{
+	std::vector<SceneMesh> meshes;
+	std::vector<Material> materials;
+	std::vector<SceneObject> objects;
+	std::vector<SceneLight> lights;
+};
 
-		//camera movement
-		glfwGetCursorPos(window, &xpos, &ypos);
-		glfwSetCursorPos(window, (double)windowWidth / 2, (double)windowHeight / 2);
+// reads a scene file, reports the offending line and returns false on malformed input
+bool LoadScene(const std::string& path, Scene& scene);
 
-		horizontalAngle += mouseSpeed * deltaTime * float(windowWidth / 2 - xpos);
-		verticalAngle += mouseSpeed * deltaTime * float(windowHeight / 2 - ypos);
+// axis-aligned bounding box
+struct Aabb
+{
+	glm::vec3 min;
+	glm::vec3 max;
+};
 
-		direction = glm::vec3(cos(verticalAngle) * sin(horizontalAngle), sin(verticalAngle), cos(verticalAngle) * cos(horizontalAngle));
-		right = glm::vec3(sin(horizontalAngle - M_PI / 2.0f), 0.0f, cos(horizontalAngle - M_PI / 2.0f));
-		up = glm::cross(right, direction);
+// box around a box under an affine transform
+Aabb TransformAabb(const Aabb& box, const glm::mat4& transform);
 
-		if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
-			position += direction * deltaTime * speed;
-		}
-		if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) {
-			position -= direction * deltaTime * speed;
-		}
-		if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
-			position += right * deltaTime * speed;
-		}
-		if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) {
-			position -= right * deltaTime * speed;
-		}
+// left, right, bottom, top, near and far planes facing inwards, xyz is the normal and w the distance
+struct Frustum
+{
+	glm::vec4 planes[6];
+};
 
+Frustum FrustumFromViewProjection(const glm::mat4& viewProjection);
 
-		// identity matrix
-		glm::mat4 iMatrix(1.0f);
+// interior nodes have a count of 0 and their children at first and first + 1,
+// leaves cover items [first, first + count). children always come after their parent
+struct BvhNode
+{
+	Aabb bounds;
+	GLuint first;
+	GLuint count;
+};
 
-		// MVP uniforms
-		glm::mat4 viewMatrix = glm::lookAt(position, position + direction, up);
-		glm::mat4 projectionMatrix = glm::perspective(glm::radians(90.0f), windowWidth / windowHeight, 0.1f, 100.0f);
-		
-		glUniformMatrix4fv(glGetUniformLocation(mainShader, "view"), 1, GL_FALSE, glm::value_ptr(viewMatrix));
-		glUniformMatrix4fv(glGetUniformLocation(mainShader, "projection"), 1, GL_FALSE, glm::value_ptr(projectionMatrix));
-
-		glBindVertexArray(vao);
-		// SET OBJECT TRANSFORMS
-		// cube
-		glm::mat4 firstMatrix = glm::scale(iMatrix, glm::vec3(2.0f, 2.0f, 2.0f));
-		firstMatrix = glm::translate(firstMatrix, glm::vec3(0.0f, 0.5f, 0.0f));
-		firstMatrix = glm::rotate(firstMatrix, glm::radians(23.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-		glm::mat4 secondMatrix = glm::scale(iMatrix, glm::vec3(1.5f, 1.5f, 1.5f));
-		secondMatrix = glm::translate(secondMatrix, glm::vec3(1.5f, 0.5f, 1.5f));
-		secondMatrix = glm::rotate(secondMatrix, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-		glm::mat4 thirdMatrix = glm::scale(iMatrix, glm::vec3(1.0f, 1.0f, 1.0f));
-		thirdMatrix = glm::translate(thirdMatrix, glm::vec3(2.5f, 2.0f, -2.0f));
-		thirdMatrix = glm::rotate(thirdMatrix, glm::radians(currentTime * 40.0f), glm::vec3(1.0f, 1.0f, 1.0f));
-		glm::mat4 fourthMatrix = glm::scale(iMatrix, glm::vec3(0.5f, 0.5f, 0.5f));
-		fourthMatrix = glm::translate(fourthMatrix, glm::vec3(5.0f, 3.5f, 5.0f));
-		fourthMatrix = glm::rotate(fourthMatrix, glm::radians(45.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-		fourthMatrix = glm::rotate(fourthMatrix, glm::radians(-90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-		glm::mat4 fifthMatrix = glm::scale(iMatrix, glm::vec3(0.5f, 2.0f, 0.5f));
-		fifthMatrix = glm::translate(fifthMatrix, glm::vec3(-2.0f, 0.8f, -5.0f));
-		fifthMatrix = glm::rotate(fifthMatrix, glm::radians(23.0f), glm::vec3(1.0f, 1.0f, 0.0f));
-		fifthMatrix = glm::rotate(fifthMatrix, glm::radians(currentTime * 60.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-		// plane
-		glm::mat4 planeMatrix = glm::scale(iMatrix, glm::vec3(10.0f, 1.0f, 10.0f));
-		planeMatrix = glm::translate(planeMatrix, glm::vec3(0, -0.5f, 0));
+// bounding volume hierarchy over the instances, items are instance indices
+struct Bvh
+{
+	std::vector<BvhNode> nodes;
+	std::vector<GLuint> items;
+};
 
+// leaves hold at most this many instances
+const GLuint BVH_LEAF_SIZE = 4;
 
-		// FIRST PASS
-		glUseProgram(depthShader);
-		glViewport(0, 0, depthTextureWidth, depthTextureHeight);
-		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-		glClear(GL_DEPTH_BUFFER_BIT);
-		
-		glUniformMatrix4fv(glGetUniformLocation(depthShader, "lightProjection"), 1, GL_FALSE, glm::value_ptr(directionalLightProjectionMatrix));
-		glUniformMatrix4fv(glGetUniformLocation(depthShader, "lightView"), 1, GL_FALSE, glm::value_ptr(directionalLightViewMatrix));
+// median split along the widest axis of the item centers
+void BuildBvh(Bvh& bvh, const std::vector<Aabb>& bounds);
+// recomputes the node bounds bottom-up after items moved, the tree itself is kept
+void RefitBvh(Bvh& bvh, const std::vector<Aabb>& bounds);
+// sets visible[i] for every item whose bounds touch the frustum, leaves the other flags alone
+void CullBvh(const Bvh& bvh, const std::vector<Aabb>& bounds, const Frustum& frustum, std::vector<uint8_t>& visible);
 
-		// DRAW 📝
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeEbo);
-		glUniformMatrix4fv(glGetUniformLocation(depthShader, "model"), 1, GL_FALSE, glm::value_ptr(firstMatrix));
-		glDrawElements(GL_TRIANGLES, cubeIndicesSize, GL_UNSIGNED_INT, 0);
-		glUniformMatrix4fv(glGetUniformLocation(depthShader, "model"), 1, GL_FALSE, glm::value_ptr(secondMatrix));
-		glDrawElements(GL_TRIANGLES, cubeIndicesSize, GL_UNSIGNED_INT, 0);
-		glUniformMatrix4fv(glGetUniformLocation(depthShader, "model"), 1, GL_FALSE, glm::value_ptr(thirdMatrix));
-		glDrawElements(GL_TRIANGLES, cubeIndicesSize, GL_UNSIGNED_INT, 0);
-		glUniformMatrix4fv(glGetUniformLocation(depthShader, "model"), 1, GL_FALSE, glm::value_ptr(fourthMatrix));
-		glDrawElements(GL_TRIANGLES, cubeIndicesSize, GL_UNSIGNED_INT, 0);
-		glUniformMatrix4fv(glGetUniformLocation(depthShader, "model"), 1, GL_FALSE, glm::value_ptr(fifthMatrix));
-		glDrawElements(GL_TRIANGLES, cubeIndicesSize, GL_UNSIGNED_INT, 0);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, planeEbo);
-		glUniformMatrix4fv(glGetUniformLocation(depthShader, "model"), 1, GL_FALSE, glm::value_ptr(planeMatrix));
-		glDrawElements(GL_TRIANGLES, planeIndicesSize, GL_UNSIGNED_INT, 0);
+// range of a mesh in the shared index buffer, its indices are relative to baseVertex in the shared vertex buffers
+struct Mesh
+{
+	std::string name;
+	GLuint firstIndex;
+	GLsizei indexCount;
+	GLint baseVertex;
+	Aabb bounds;	// local space
+};
 
+// read-only view of a whole file
+struct MappedFile
+{
+	const uint8_t* data;
+	size_t size;
+};
 
-		// SECOND PASS
-		glUseProgram(mainShader);
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-		glViewport(0, 0, windowWidth, windowHeight);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+bool MapFile(const std::string& path, MappedFile& mapped);
+void UnmapFile(MappedFile& mapped);
+// checks the header and block bounds of a mapped .mesh file
+bool ValidateMeshFile(const std::string& path, const MappedFile& mapped);
+// maps every scene mesh and uploads its position, attribute and index blocks as they are into vbo, attributeVbo
+// and ebo, one mesh after another. all meshes of a scene must share one layout
+bool UploadMeshes(const std::vector<SceneMesh>& sceneMeshes, GLuint vbo, GLuint attributeVbo, GLuint ebo, std::vector<Mesh>& meshes, MeshLayout& layout);
+// points attributes 0 to 2 of the bound VAO at the mesh streams and binds the index buffer,
+// positionsOnly leaves out color and normal
+void SetVertexAttributes(MeshLayout layout, GLuint vbo, GLuint attributeVbo, GLuint ebo, bool positionsOnly);
+// enables the first attributeCount per-instance attributes of the bound VAO and points them at instance 0
+void SetInstanceAttributes(GLuint instanceVbo, GLuint attributeCount);
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, depthTexture);
-		glUniform1i(glGetUniformLocation(mainShader, "shadowMap"), 0);
-		
-		glUniform3fv(glGetUniformLocation(mainShader, "viewPosition"), 1, glm::value_ptr(position));
+// a run of consecutive instances sharing a mesh
+struct RenderBatch
+{
+	size_t mesh;
+	GLuint firstInstance;
+	GLuint instanceCount;
+	bool dynamic;
+};
 
-		// directional light uniforms
-		glUniform3fv(glGetUniformLocation(mainShader, "directionalLightDirection"), 1, glm::value_ptr(directionalLightDirection));
-		glUniform3fv(glGetUniformLocation(mainShader, "directionalLightAmbient"), 1, glm::value_ptr(directionalLightAmbient));
-		glUniform3fv(glGetUniformLocation(mainShader, "directionalLightDiffuse"), 1, glm::value_ptr(directionalLightDiffuse));
-		glUniform3fv(glGetUniformLocation(mainShader, "directionalLightSpecular"), 1, glm::value_ptr(directionalLightSpecular));
-		
-		glUniformMatrix4fv(glGetUniformLocation(mainShader, "lightProjection"), 1, GL_FALSE, glm::value_ptr(directionalLightProjectionMatrix));
-		glUniformMatrix4fv(glGetUniformLocation(mainShader, "lightView"), 1, GL_FALSE, glm::value_ptr(directionalLightViewMatrix));
-		
-		// DRAW AGAIN 😎
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeEbo);
-		glUniformMatrix4fv(glGetUniformLocation(mainShader, "model"), 1, GL_FALSE, glm::value_ptr(firstMatrix));
-		glDrawElements(GL_TRIANGLES, cubeIndicesSize, GL_UNSIGNED_INT, 0);
-		glUniformMatrix4fv(glGetUniformLocation(mainShader, "model"), 1, GL_FALSE, glm::value_ptr(secondMatrix));
-		glDrawElements(GL_TRIANGLES, cubeIndicesSize, GL_UNSIGNED_INT, 0);
-		glUniformMatrix4fv(glGetUniformLocation(mainShader, "model"), 1, GL_FALSE, glm::value_ptr(thirdMatrix));
-		glDrawElements(GL_TRIANGLES, cubeIndicesSize, GL_UNSIGNED_INT, 0);
-		glUniformMatrix4fv(glGetUniformLocation(mainShader, "model"), 1, GL_FALSE, glm::value_ptr(fourthMatrix));
-		glDrawElements(GL_TRIANGLES, cubeIndicesSize, GL_UNSIGNED_INT, 0);
-		glUniformMatrix4fv(glGetUniformLocation(mainShader, "model"), 1, GL_FALSE, glm::value_ptr(fifthMatrix));
-		glDrawElements(GL_TRIANGLES, cubeIndicesSize, GL_UNSIGNED_INT, 0);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, planeEbo);
-		glUniformMatrix4fv(glGetUniformLocation(mainShader, "model"), 1, GL_FALSE, glm::value_ptr(planeMatrix));
-		glDrawElements(GL_TRIANGLES, planeIndicesSize, GL_UNSIGNED_INT, 0);
-
-
-		glBindVertexArray(0);
+// DRAW SORT KEYS
+// most significant first: pass (4 bits) | program (12) | material (16) | mesh (16) | depth (16),
+// so sorting a queue groups state changes from the most to the least expensive
+enum RenderPass : uint32_t
+{
+	RENDER_PASS_SHADOW = 0,
+	RENDER_PASS_MAIN = 1,
+};
 
-		glfwSwapBuffers(window);
+uint64_t MakeDrawSortKey(uint32_t pass, uint32_t program, uint32_t material, uint32_t mesh, float depth);
 
-		glfwPollEvents();
-	}
+// one entry of a view's render queue, batch indexes the view's batches
+struct DrawItem
+{
+	uint64_t key;
+	uint32_t batch;
+};
 
-	glDeleteProgram(mainShader);
-	glDeleteProgram(depthShader);
+// spins a transform around its axis on top of its rest rotation
+struct Animation
+{
+	size_t transform;
+	glm::quat baseRotation;
+	glm::vec3 axis;
+	GLfloat speed;
+};
 
-	glDeleteBuffers(1, &vbo);
-	glDeleteVertexArrays(1, &vao);
-	glDeleteFramebuffers(1, &fbo);
+// flat list both passes iterate: instances sorted static first and by mesh, one batch per run
+struct RenderList
+{
+	std::vector<InstanceData> instances;
+	std::vector<RenderBatch> batches;
+	std::vector<Animation> animations;
+	// per instance, for culling
+	std::vector<size_t> instanceMeshes;
+	std::vector<Aabb> bounds;	// world space
+	Bvh bvh;
+};
 
-	glfwTerminate();
+// recomputes the world bounds of one instance from its model matrix
+void UpdateWorldBounds(RenderList& renderList, const std::vector<Mesh>& meshes, size_t instance);
+// copies the visible instances of every batch to the end of culledInstances and describes them in batches
+void AppendVisibleBatches(const RenderList& renderList, const std::vector<uint8_t>& visible,
+	std::vector<InstanceData>& culledInstances, std::vector<RenderBatch>& batches);
 
-	return 0;
-}
+// resolves mesh and material names, fills transforms and renderList in instance order
+bool BuildRenderList(const Scene& scene, const std::vector<Mesh>& meshes, TransformStore& transforms, RenderList& renderList);
 
-GLuint CreateShaderProgram(const std::string& vertexShaderFilePath, const std::string& fragmentShaderFilePath)
+// uniform block binding points, must match the layout(binding = ...) in the shaders
+const GLuint PER_FRAME_UNIFORM_BINDING = 0;
+const GLuint LIGHTS_UNIFORM_BINDING = 1;
+
+// std140 mirror of the PerFrame block, vec3s are stored as vec4s
+struct PerFrameUniforms
 {
-	GLuint vertexShader = CreateShaderFromFile(GL_VERTEX_SHADER, vertexShaderFilePath);
-	GLuint fragmentShader = CreateShaderFromFile(GL_FRAGMENT_SHADER, fragmentShaderFilePath);
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::vec4 viewPosition;
+};
 
-	GLuint program = glCreateProgram();
-	glAttachShader(program, vertexShader);
-	glAttachShader(program, fragmentShader);
+// which objects a draw covers, static casters can be cached in the shadow pass
+enum class ShadowCasters
+{
+	All,
+	Static,
+	Dynamic
+};
 
-	glLinkProgram(program);
+// injected into every shader as CASCADE_COUNT, at most 4 so the splits fit in one vec4
+const int CASCADE_COUNT = 4;
+// how far from the camera the last cascade reaches
+const GLfloat SHADOW_DISTANCE = 40.0f;
+// blend between uniform (0) and logarithmic (1) cascade splits
+const GLfloat CASCADE_SPLIT_LAMBDA = 0.75f;
+// extra depth behind each cascade so casters outside the camera view still cast into it
+const GLfloat SHADOW_CASTER_MARGIN = 20.0f;
 
-	glDetachShader(program, vertexShader);
-	glDeleteShader(vertexShader);
-	glDetachShader(program, fragmentShader);
-	glDeleteShader(fragmentShader);
+// std140 mirror of the Lights block
+struct LightsUniforms
+{
+	glm::mat4 lightViewProjection[CASCADE_COUNT];
+	glm::vec4 cascadeSplits;	// view-space far distance of each cascade
+	glm::vec4 directionalLightDirection;
+	glm::vec4 directionalLightAmbient;
+	glm::vec4 directionalLightDiffuse;
+	glm::vec4 directionalLightSpecular;
+	glm::vec4 shadowMapScale;	// x is the fraction of each cascade layer that is rendered
+};
 
-	// Check shader program link status
-	GLint linkStatus;
-	glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
-	if (linkStatus != GL_TRUE) {
-		char infoLog[512];
-		GLsizei infoLogLen = sizeof(infoLog);
-		glGetProgramInfoLog(program, infoLogLen, &infoLogLen, infoLog);
-		std::cerr << "program link error: " << infoLog << std::endl;
-	}
+// CLUSTERED LIGHTING
+// local lights are binned by cluster.csh into a grid of view-space clusters, CLUSTER_GRID_X by CLUSTER_GRID_Y
+// screen tiles with CLUSTER_GRID_Z exponentially spaced depth slices, and main.fsh only loops over its cluster's lights.
+// needs GL 4.3, without it only the directional light is drawn
+const int CLUSTER_GRID_X = 16;
+const int CLUSTER_GRID_Y = 9;
+const int CLUSTER_GRID_Z = 24;
+const int CLUSTER_COUNT = CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z;
+// each cluster stores its count followed by this many light indices, further lights are dropped
+const int MAX_LIGHTS_PER_CLUSTER = 63;
+const size_t MAX_LOCAL_LIGHTS = 1024;
+// must match local_size_x in cluster.csh
+const GLuint CLUSTER_GROUP_SIZE = 64;
 
-	return program;
-}
+// shader storage and uniform block bindings, must match main.fsh and cluster.csh.
+// storage bindings 0 to 3 belong to cull.csh
+const GLuint LOCAL_LIGHTS_BINDING = 4;
+const GLuint SHADOW_VIEWS_BINDING = 5;
+const GLuint CLUSTER_LIGHTS_BINDING = 6;
+const GLuint CLUSTERING_UNIFORM_BINDING = 3;
 
-GLuint CreateShaderFromFile(const GLuint& shaderType, const std::string& shaderFilePath)
+// std430 mirror of LocalLight
+struct GpuLight
 {
-	std::ifstream shaderFile(shaderFilePath);
-	if (shaderFile.fail())
-	{
-		std::cerr << "Unable to open shader file: " << shaderFilePath << std::endl;
-		return 0;
-	}
+	glm::vec4 position;	// w is the range
+	glm::vec4 color;
+	glm::vec4 direction;	// w is the outer cone angle
+	GLfloat coneInner;
+	GLint type;
+	GLint shadowView;	// first of six for point lights, -1 without a shadow
+	GLfloat padding;
+};
 
-	std::string shaderSource;
-	std::string temp;
-	while (std::getline(shaderFile, temp))
-	{
-		shaderSource += temp + "\n";
-	}
-	shaderFile.close();
+// std140 mirror of the Clustering block
+struct ClusteringUniforms
+{
+	glm::mat4 inverseProjection;
+	glm::vec4 clusterParams;	// cluster width and height in pixels, near and far plane
+	GLuint localLightCount;
+	GLuint padding[3];
+};
 
-	return CreateShaderFromSource(shaderType, shaderSource);
-}
+// SHADOW ATLAS
+// one depth texture holding the shadow views of every shadowed local light, a spot light takes one
+// perspective view and a point light six, one per cube face. its size is the whole shadow memory budget,
+// tiles are handed out again every frame by a quadtree so the lights that are largest on screen get the most texels
+const GLuint SHADOW_ATLAS_SIZE = 4096;
+const GLuint SHADOW_ATLAS_MIN_TILE_SIZE = 128;
+const GLuint SHADOW_ATLAS_MAX_TILE_SIZE = 1024;
+const GLfloat LOCAL_SHADOW_NEAR_PLANE = 0.05f;
 
-GLuint CreateShaderFromSource(const GLuint& shaderType, const std::string& shaderSource)
+struct ShadowView
 {
-	GLuint shader = glCreateShader(shaderType);
+	glm::mat4 viewProjection;
+	glm::vec3 position, forward;	// for culling and sorting the view's casters
+	GLuint x, y, size;	// atlas tile in texels, valid while its light has tiles
+};
 
-	const char* shaderSourceCStr = shaderSource.c_str();
-	GLint shaderSourceLen = static_cast<GLint>(shaderSource.length());
-	glShaderSource(shader, 1, &shaderSourceCStr, &shaderSourceLen);
-	glCompileShader(shader);
+// a light with shadow views, which are [firstView, firstView + viewCount) of the shadow views
+struct ShadowedLight
+{
+	size_t light;	// index into the scene's lights
+	GLuint firstView, viewCount;
+	GLuint tileSize;	// this frame's, 0 without tiles
+	// small tiles are refreshed every few frames, a new tile is always rendered right away
+	GLuint refreshInterval;
+	uint64_t lastRendered;
+	bool render;	// its views are rendered this frame
+};
 
-	// Check compilation status
-	GLint compileStatus;
-	glGetShaderiv(shader, GL_COMPILE_STATUS, &compileStatus);
-	if (compileStatus == GL_FALSE)
-	{
-		char infoLog[512];
-		GLsizei infoLogLen = sizeof(infoLog);
-		glGetShaderInfoLog(shader, infoLogLen, &infoLogLen, infoLog);
-		std::cerr << "shader compilation error: " << infoLog << std::endl;
-	}
+// quadtree over the atlas, level 0 is the whole texture and every level halves the tile size
+enum ShadowAtlasNode : uint8_t
+{
+	SHADOW_NODE_FREE,
+	SHADOW_NODE_SPLIT,	// some descendant is used
+	SHADOW_NODE_USED,
+};
 
-	return shader;
-}
+struct ShadowAtlasAllocator
+{
+	GLuint size;
+	std::vector<std::vector<uint8_t>> levels;	// node states, row major, 2^level nodes per side
+};
 
-void FramebufferSizeChangedCallback(GLFWwindow* window, int width, int height)
+// frees every tile, sized to hold tiles from size down to minTileSize
+void ResetShadowAtlas(ShadowAtlasAllocator& atlas, GLuint size, GLuint minTileSize);
+// first free power-of-two tile of tileSize in z-order
+bool AllocateShadowTile(ShadowAtlasAllocator& atlas, GLuint tileSize, GLuint& x, GLuint& y);
+// claims the tile at x, y again if it is still free, keeps a light's contents across frames
+bool ReserveShadowTile(ShadowAtlasAllocator& atlas, GLuint tileSize, GLuint x, GLuint y);
+void FreeShadowTile(ShadowAtlasAllocator& atlas, GLuint tileSize, GLuint x, GLuint y);
+
+// sizes every light's tiles by its projected radius on screen, screenScale being the pixels per unit at distance 1.
+// lights that keep their size keep their tiles, those that don't fit at the smallest size go without a shadow
+void AssignShadowAtlas(ShadowAtlasAllocator& atlas, std::vector<ShadowedLight>& shadowedLights, std::vector<ShadowView>& views,
+	const std::vector<SceneLight>& lights, const Frustum& cameraFrustum, const glm::vec3& cameraPosition, GLfloat screenScale, uint64_t frame,
+	GLuint refreshScale);
+
+// std430 mirror of main.fsh's ShadowView
+struct GpuShadowView
 {
-	// Whenever the size of the framebuffer changed (due to window resizing, etc.),
-	// update the dimensions of the region to the new size
-	glViewport(0, 0, width, height);
+	glm::mat4 viewProjection;
+	glm::vec4 atlasRect;	// offset and size in atlas texture coordinates
+};
+
+// depth texture with hardware comparison, like one cascade layer
+GLuint CreateShadowAtlas(GLuint size);
+// builds the views of every light that casts a shadow, tiles are assigned later by AssignShadowAtlas
+void BuildLocalShadowViews(const std::vector<SceneLight>& lights, std::vector<ShadowView>& views, std::vector<ShadowedLight>& shadowedLights);
+
+// JOBS
+// a group of jobs to wait for, counts the ones still running
+typedef std::atomic<int> JobCounter;
+
+struct Job
+{
+	std::function<void()> function;
+	JobCounter* counter;
+};
+
+struct JobQueue
+{
+	std::mutex mutex;
+	std::deque<Job> jobs;
+};
+
+// work-stealing thread pool: every thread pushes to and pops from the back of its own queue,
+// idle threads steal from the front of the others. queue 0 belongs to the thread that started it and any other outside thread
+struct JobSystem
+{
+	std::vector<std::unique_ptr<JobQueue>> queues;
+	std::vector<std::thread> workers;
+	std::atomic<bool> running;
+	std::atomic<int> queuedJobs;
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+};
+
+// starts workerCount workers, by default one less than there are cores. the starting thread works too while it waits
+void StartJobSystem(JobSystem& jobs, unsigned workerCount = 0);
+void StopJobSystem(JobSystem& jobs);
+void SubmitJob(JobSystem& jobs, JobCounter& counter, std::function<void()> function);
+// runs queued jobs on the calling thread until every job of the counter has finished
+void WaitForJobs(JobSystem& jobs, JobCounter& counter);
+// splits [0, count) into ranges of at most grain items and waits for all of them
+void ParallelFor(JobSystem& jobs, size_t count, size_t grain, const std::function<void(size_t, size_t)>& function);
+
+// MATERIAL TEXTURES
+// every material texture is resampled to one size and kept in a layer of one array texture with its full mip chain.
+// loader threads decode the images, build the mips and, with S3TC support, compress them to BC1, the render thread
+// only copies finished chains into the array through a pixel unpack stream. every layer starts out white, so the
+// scene shows right away and fills in as the textures arrive, and untextured materials simply use layer 0
+const GLuint MATERIAL_TEXTURE_SIZE = 512;
+const GLuint MATERIAL_TEXTURE_LEVELS = 10;	// 512 down to 1
+// the shadow maps take units 0 to 2
+const GLuint MATERIAL_TEXTURE_UNIT = 3;
+// a pool of its own, the render thread helps out while waiting on the culling jobs and must not end up decoding
+const unsigned TEXTURE_LOADER_THREADS = 2;
+// bytes of texture data copied per frame, a single chain larger than this goes up alone
+const GLsizeiptr TEXTURE_UPLOAD_BUDGET = 2 * 1024 * 1024;
+
+// one finished mip chain, levels packed back to back from the largest
+struct DecodedTexture
+{
+	GLuint layer = 0;
+	std::vector<uint8_t> data;	// BC1 blocks or RGBA8 texels
+	size_t levelOffsets[MATERIAL_TEXTURE_LEVELS + 1] = {};	// the last one is the total size
+};
+
+struct TextureLoader
+{
+	GLuint texture = 0;
+	bool compressed = false;	// whether the array holds BC1 blocks instead of RGBA8 texels
+	JobSystem jobs;
+	JobCounter pending{ 0 };	// decodes still queued or running
+	std::mutex mutex;
+	std::deque<DecodedTexture> decoded;	// queued by the loader threads, taken by UploadLoadedTextures
+	StreamBuffer uploadStream;	// deleted once the last texture is up
+};
+
+// creates the array and queues a decode for every texture the materials use
+bool StartTextureLoader(TextureLoader& loader, const Scene& scene);
+// uploads the decoded textures that fit this frame's budget, returns false once every texture is up
+bool UploadLoadedTextures(TextureLoader& loader, GlStateCache& state);
+// drops the decodes that haven't started, waits for the running ones and deletes the array
+void StopTextureLoader(GlStateCache& state, TextureLoader& loader);
+// loads an image and builds its mip chain at MATERIAL_TEXTURE_SIZE, safe to run on any thread
+bool DecodeMaterialTexture(const std::string& path, bool compress, DecodedTexture& texture);
+// bilinear resample of an RGBA8 image to size x size, sources far larger than that alias
+void ResampleImage(const uint8_t* pixels, int width, int height, GLuint size, std::vector<uint8_t>& target);
+// 2x2 box filter of a square RGBA8 image
+void DownsampleImage(const std::vector<uint8_t>& source, GLuint size, std::vector<uint8_t>& target);
+// BC1 of a square RGBA8 image: the endpoints span each block's color bounds, every texel takes the nearest of four colors
+void EncodeBc1(const std::vector<uint8_t>& pixels, GLuint size, std::vector<uint8_t>& blocks);
+
+// culling views: the camera, then one per cascade, then the union of all cascades for the layered pass
+const int CAMERA_VIEW = 0;
+const int LAYERED_VIEW = CASCADE_COUNT + 1;
+const int CULL_VIEW_COUNT = CASCADE_COUNT + 2;
+
+// one culling job: instances that touch any of the frusta, packed per batch
+struct CullView
+{
+	Frustum frustums[CASCADE_COUNT];
+	int frustumCount;
+	// key fields shared by every draw of the view, depth is measured front to back along depthPlane
+	RenderPass pass;
+	GLuint program;
+	glm::vec4 depthPlane;
+	std::vector<uint8_t> visible;
+	std::vector<InstanceData> instances;
+	std::vector<RenderBatch> batches;
+	std::vector<DrawItem> queue;	// batches in draw order
+};
+
+void RunCullView(const RenderList& renderList, CullView& view);
+
+// GPU-DRIVEN RENDERING
+// GL's layout for glMultiDrawElementsIndirect, one per view and batch, instanceCount is filled by cull.csh
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+// std430 mirror of cull.csh's Bounds entries, w of min holds the instance's batch
+struct GpuBounds
+{
+	glm::vec4 min;
+	glm::vec4 max;
+};
+
+// uniform block and shader storage bindings of cull.csh
+const GLuint CULLING_UNIFORM_BINDING = 2;
+const GLuint CULL_INSTANCES_BINDING = 0;
+const GLuint CULL_BOUNDS_BINDING = 1;
+const GLuint CULL_COMMANDS_BINDING = 2;
+const GLuint CULL_OUTPUT_BINDING = 3;
+// must match local_size_x in cull.csh
+const GLuint CULL_GROUP_SIZE = 64;
+
+// std140 mirror of cull.csh's Culling block
+struct CullingUniforms
+{
+	glm::vec4 frustumPlanes[CULL_VIEW_COUNT * CASCADE_COUNT * 6];
+	glm::ivec4 frustumCounts[CULL_VIEW_COUNT];	// only x is used
+	GLuint instanceCount;
+	GLuint batchCount;
+	GLuint viewMask;	// bit per view that is drawn this frame
+	GLuint padding;
+};
+
+// FRAME PROFILER
+// timed sections of the render loop, PROFILE_FRAME spans all the others
+enum ProfileSection : int
+{
+	PROFILE_FRAME = 0,
+	PROFILE_CULL = 1,
+	PROFILE_SHADOW_PASS = 2,
+	PROFILE_LOCAL_SHADOW_PASS = 3,
+	PROFILE_MOMENTS_PASS = 4,
+	PROFILE_MAIN_PASS = 5,
+	PROFILE_SECTION_COUNT = 6,
+};
+const char* const PROFILE_SECTION_NAMES[PROFILE_SECTION_COUNT] = { "frame", "cull", "shadow", "local", "moments", "main" };
+// frames of queries in flight, a slot is only read back when the ring wraps around to it, so reading never waits on the GPU
+const int PROFILER_QUERY_FRAMES = 4;
+// frames the rolling statistics cover
+const size_t PROFILER_HISTORY_FRAMES = 240;
+const char* const PROFILER_CSV_FILE = "profile.csv";
+const char* const BENCHMARK_CSV_FILE = "benchmark.csv";
+
+// one section's cost in one frame, triangles don't include GPU-culled indirect draws since only the GPU knows their count
+struct ProfileSample
+{
+	uint64_t frame;
+	GLfloat cpuMilliseconds;
+	GLfloat gpuMilliseconds;
+	GLuint drawCalls;
+	GLuint64 triangles;
+};
+
+struct ProfileStats
+{
+	GLfloat min;
+	GLfloat average;
+	GLfloat p99;
+};
+
+struct FrameProfiler
+{
+	// GL_TIMESTAMP pairs, so sections can nest
+	GLuint queries[PROFILER_QUERY_FRAMES][PROFILE_SECTION_COUNT][2];
+	// CPU side of each slot's sections, completed once its queries are read back
+	ProfileSample pending[PROFILER_QUERY_FRAMES][PROFILE_SECTION_COUNT];
+	bool issued[PROFILER_QUERY_FRAMES][PROFILE_SECTION_COUNT];
+	std::chrono::steady_clock::time_point cpuStarts[PROFILE_SECTION_COUNT];
+	// sections that are open, draws are counted into all of them
+	bool open[PROFILE_SECTION_COUNT];
+	int slot;
+	std::deque<ProfileSample> history[PROFILE_SECTION_COUNT];
+	// every resolved sample is appended while recording
+	std::ofstream csv;
+};
+
+void CreateFrameProfiler(FrameProfiler& profiler);
+void DeleteFrameProfiler(FrameProfiler& profiler);
+// moves to the next slot of the ring, first resolving the samples it still holds from PROFILER_QUERY_FRAMES frames ago
+void BeginProfileFrame(FrameProfiler& profiler, uint64_t frame);
+void BeginProfileSection(FrameProfiler& profiler, ProfileSection section);
+void EndProfileSection(FrameProfiler& profiler, ProfileSection section);
+void CountProfileDraw(FrameProfiler& profiler, GLuint64 triangles);
+// min, average and 99th percentile, sorts the values
+ProfileStats ComputeStats(std::vector<GLfloat>& milliseconds);
+// the same over the section's history
+ProfileStats ComputeProfileStats(const FrameProfiler& profiler, ProfileSection section, bool gpu);
+std::string FormatProfileSummary(const FrameProfiler& profiler);
+bool StartProfileRecording(FrameProfiler& profiler, const std::string& path);
+void StopProfileRecording(FrameProfiler& profiler);
+
+// ADAPTIVE SHADOW QUALITY
+// steps from the best to the cheapest shadows: the fraction of each cascade layer that is rendered, through a smaller
+// viewport so nothing is reallocated, and the factor on the atlas refresh intervals of local lights
+struct ShadowQualityLevel
+{
+	GLfloat resolutionScale;
+	GLuint refreshScale;
+};
+const ShadowQualityLevel SHADOW_QUALITY_LEVELS[] = { { 1.0f, 1 }, { 0.875f, 1 }, { 0.75f, 1 }, { 0.75f, 2 }, { 0.625f, 2 }, { 0.5f, 2 }, { 0.5f, 4 } };
+const int SHADOW_QUALITY_LEVEL_COUNT = sizeof(SHADOW_QUALITY_LEVELS) / sizeof(SHADOW_QUALITY_LEVELS[0]);
+// GPU milliseconds of the cascade, local shadow and moments passes together
+const GLfloat DEFAULT_SHADOW_BUDGET = 2.0f;
+// resolved frames at the current level before the next decision, a change only shows up PROFILER_QUERY_FRAMES later
+const size_t SHADOW_QUALITY_SAMPLES = 30;
+// quality only goes back up below this fraction of the budget. no level costs over 1 / 0.6 times the next cheaper one, so it can't oscillate
+const GLfloat SHADOW_QUALITY_RAISE_THRESHOLD = 0.6f;
+
+struct ShadowQualityController
+{
+	bool enabled;
+	GLfloat budgetMilliseconds;
+	int level;
+	uint64_t levelFrame;	// first frame rendered at the current level
+};
+
+// moves at most one level against the budget, returns true if it did
+bool UpdateShadowQuality(ShadowQualityController& controller, const FrameProfiler& profiler, uint64_t frame);
+
+// BENCHMARK
+// --benchmark renders offscreen without vsync along a scripted camera path and prints frame time statistics
+// for every configuration as CSV to BENCHMARK_CSV_FILE, the -mwindows build has no console to print to
+struct BenchmarkSettings
+{
+	bool enabled = false;
+	size_t objectCount = 0;	// 0 keeps the scene file's objects
+	GLuint shadowSize = 1024;	// cascade resolution, also applies outside the benchmark
+	GLfloat shadowBudget = DEFAULT_SHADOW_BUDGET;	// of the adaptive shadow quality, 0 turns it off, never used by the benchmark
+	int frames = 300;	// measured per configuration
+};
+
+// one measured combination of the runtime toggles
+struct BenchmarkConfiguration
+{
+	int pcfKernel;
+	bool instanced;
+	bool gpuDriven;
+	std::vector<GLfloat> cpuMilliseconds;
+	std::vector<GLfloat> gpuMilliseconds;
+};
+
+// every configuration warms up first, so permutations are compiled and the previous one's queries have resolved
+const int BENCHMARK_WARMUP_FRAMES = 60;
+// fixed simulation step of the camera path and the animations
+const GLfloat BENCHMARK_TIMESTEP = 1.0f / 60.0f;
+// one lap around the scene takes this long
+const GLfloat BENCHMARK_ORBIT_SECONDS = 10.0f;
+// the scene file's ground plane is 10 units wide, so generated copies of it line up
+const GLfloat BENCHMARK_TILE_SPACING = 10.0f;
+
+// FRAME PACING
+// camera movement and animations advance in fixed steps, decoupled from the frame rate
+const GLfloat SIMULATION_TIMESTEP = 1.0f / 120.0f;
+// a long stall is dropped beyond this many steps instead of being caught up over the following frames
+const int MAX_SIMULATION_STEPS = 8;
+// the remaining wait before a frame deadline is spun instead of slept, sleeps overshoot by up to a scheduler tick
+const std::chrono::microseconds FRAME_LIMITER_SPIN_TIME(2000);
+
+struct FramePacingSettings
+{
+	int swapInterval = 1;	// 0 disables vsync, the benchmark always runs with 0
+	GLfloat frameRateLimit = 0.0f;	// frames per second, 0 is unlimited
+};
+
+// what a simulation step advances, rendering interpolates the last two
+struct SimulationState
+{
+	glm::vec3 position;
+	GLfloat horizontalAngle;
+	GLfloat verticalAngle;
+	GLfloat time;
+};
+
+void CameraBasis(GLfloat horizontalAngle, GLfloat verticalAngle, glm::vec3& direction, glm::vec3& right, glm::vec3& up);
+// moves the camera by the held WASD keys and advances the animation time
+void StepSimulation(GLFWwindow* window, SimulationState& state, GLfloat timestep, GLfloat speed);
+// blocks until the deadline, then schedules the next one interval later, or from now after a missed one
+void WaitForFrameDeadline(std::chrono::steady_clock::time_point& deadline, std::chrono::steady_clock::duration interval);
+
+// reads --benchmark, --objects <count>, --shadow-size <texels>, --shadow-budget <ms>, --frames <count>, --swap-interval <n>
+// and --fps-limit <n>, prints usage and returns false otherwise
+bool ParseCommandLine(int argc, char* argv[], BenchmarkSettings& settings, FramePacingSettings& framePacing);
+// replaces the objects with copies of the whole layout on a square grid until there are objectCount of them
+void GenerateBenchmarkScene(Scene& scene, size_t objectCount);
+// orbits the generated grid, looking at its center
+void BenchmarkCameraPath(GLfloat time, GLfloat radius, glm::vec3& position, GLfloat& horizontalAngle, GLfloat& verticalAngle);
+GLfloat BenchmarkOrbitRadius(size_t objectCount, size_t objectsPerTile);
+// overwrites path with one CSV row per configuration
+bool WriteBenchmarkResults(const std::string& path, const std::vector<BenchmarkConfiguration>& configurations,
+	const BenchmarkSettings& settings, const int pcfKernelTaps[], size_t objectCount);
+
+
+int main(int argc, char* argv[])
+{
+	BenchmarkSettings benchmark;
+	FramePacingSettings framePacing;
+	if (!ParseCommandLine(argc, argv, benchmark, framePacing))
+	{
+		return 1;
+	}
+
+	// Initialize GLFW
+	int glfwInitStatus = glfwInit();
+	if (glfwInitStatus == GLFW_FALSE)
+	{
+		std::cerr << "Failed to initialize GLFW!" << std::endl;
+		return 1;
+	}
+
+	// Tell GLFW that we prefer to use OpenGL 4.3, which the GPU-driven path needs
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+
+	// Tell GLFW that we prefer to use the modern OpenGL
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GLFW_TRUE);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+	// the benchmark only needs the context, it renders into its own framebuffer
+	if (benchmark.enabled)
+	{
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	}
+
+	// Tell GLFW to create a window
+	float windowWidth = 800;
+	float windowHeight = 800;
+	GLFWwindow* window = glfwCreateWindow(windowWidth, windowHeight, "Shadow Mapping 👻", nullptr, nullptr);
+	if (window == nullptr)
+	{
+		// fall back to OpenGL 3.3 without the GPU-driven path
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		window = glfwCreateWindow(windowWidth, windowHeight, "Shadow Mapping 👻", nullptr, nullptr);
+	}
+	if (window == nullptr)
+	{
+		std::cerr << "Failed to create GLFW window!" << std::endl;
+		glfwTerminate();
+		return 1;
+	}
+
+	// Tell GLFW to use the OpenGL context that was assigned to the window that we just created
+	glfwMakeContextCurrent(window);
+	glfwSwapInterval(benchmark.enabled ? 0 : framePacing.swapInterval);
+
+	// Register the callback function that handles when the framebuffer size has changed
+	glfwSetFramebufferSizeCallback(window, FramebufferSizeChangedCallback);
+
+	// Tell GLAD to load the OpenGL function pointers
+	if (!gladLoadGLLoader(reinterpret_cast<GLADloadproc>(glfwGetProcAddress)))
+	{
+		std::cerr << "Failed to initialize GLAD!" << std::endl;
+		return 1;
+	}
+
+	InitParallelShaderCompile();
+
+	// compute shaders, SSBOs and multi-draw indirect all arrive with 4.3
+	bool gpuDrivenSupported = GLAD_GL_VERSION_4_3;
+	bool clusteredLightingSupported = GLAD_GL_VERSION_4_3;
+
+	JobSystem jobs;
+	StartJobSystem(jobs);
+
+	// SCENE
+	Scene scene;
+	if (!LoadScene(SCENE_FILE, scene))
+	{
+		return 1;
+	}
+	size_t sceneFileObjectCount = scene.objects.size();
+	if (benchmark.objectCount > 0)
+	{
+		GenerateBenchmarkScene(scene, benchmark.objectCount);
+	}
+
+	// MATERIAL TEXTURES
+	// the decodes overlap the rest of the startup
+	TextureLoader textureLoader;
+	if (!StartTextureLoader(textureLoader, scene))
+	{
+		return 1;
+	}
+
+	// VBO and EBO setup, filled straight from the mapped mesh files
+	// positions live in vbo, colors and normals in attributeVbo, so the depth pass only reads vbo
+	// every mesh's indices live in the one ebo, which the VAOs keep bound
+	GLuint vbo, attributeVbo, ebo;
+	glGenBuffers(1, &vbo);
+	glGenBuffers(1, &attributeVbo);
+	glGenBuffers(1, &ebo);
+	std::vector<Mesh> meshes;
+	MeshLayout meshLayout;
+	if (!UploadMeshes(scene.meshes, vbo, attributeVbo, ebo, meshes, meshLayout))
+	{
+		return 1;
+	}
+
+	// VAO setup
+	GLuint vao;
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+	SetVertexAttributes(meshLayout, vbo, attributeVbo, ebo, false);
+	glBindVertexArray(0);
+
+	// depth-only VAO, depth.vsh reads nothing but the position
+	GLuint depthVao;
+	glGenVertexArrays(1, &depthVao);
+	glBindVertexArray(depthVao);
+	SetVertexAttributes(meshLayout, vbo, attributeVbo, ebo, true);
+	glBindVertexArray(0);
+
+	// INSTANCING
+	TransformStore transforms;
+	RenderList renderList;
+	if (!BuildRenderList(scene, meshes, transforms, renderList))
+	{
+		return 1;
+	}
+	std::vector<InstanceData>& instances = renderList.instances;
+	GLsizeiptr instancesSize = instances.size() * sizeof(InstanceData);
+
+	// CULLING
+	// static objects never move, so their bounds and the tree are built once and only refit for the animated ones
+	UpdateWorldMatrices(transforms, instances.data());
+	for (size_t i = 0; i < instances.size(); i++)
+	{
+		UpdateWorldBounds(renderList, meshes, i);
+	}
+	BuildBvh(renderList.bvh, renderList.bounds);
+	// the fixed views, followed by one per local shadow view
+	std::vector<CullView> cullViews(CULL_VIEW_COUNT);
+	// the visible instances of every view this frame, one after another
+	std::vector<InstanceData> culledInstances;
+	// transforms are updated in ranges of whole SIMD groups
+	const size_t TRANSFORM_UPDATE_GRAIN = 256;
+
+	// GPU-DRIVEN RENDERING
+	// cull.csh reads every instance and its bounds, and appends the visible ones of each view to gpuCulledInstanceVbo
+	// through one indirect command per view and batch. instances are sorted static first,
+	// so only the dynamic tail of both buffers is uploaded per frame
+	GLuint instanceCount = static_cast<GLuint>(instances.size());
+	GLuint batchCount = static_cast<GLuint>(renderList.batches.size());
+	GLuint staticBatchCount = 0;
+	GLuint firstDynamicInstance = instanceCount;
+	std::vector<GpuBounds> gpuBounds(instances.size());
+	for (GLuint batch = 0; batch < batchCount; batch++)
+	{
+		const RenderBatch& renderBatch = renderList.batches[batch];
+		if (!renderBatch.dynamic)
+		{
+			staticBatchCount++;
+		}
+		else if (firstDynamicInstance == instanceCount)
+		{
+			firstDynamicInstance = renderBatch.firstInstance;
+		}
+		for (GLuint i = renderBatch.firstInstance; i < renderBatch.firstInstance + renderBatch.instanceCount; i++)
+		{
+			gpuBounds[i] = { glm::vec4(renderList.bounds[i].min, static_cast<float>(batch)), glm::vec4(renderList.bounds[i].max, 0.0f) };
+		}
+	}
+
+	ShaderProgram cullProgram;
+	GLuint gpuInstanceBuffer = 0, gpuBoundsBuffer = 0, commandTemplateBuffer = 0, commandBuffer = 0;
+	GLuint gpuCulledInstanceVbo = 0;
+	if (gpuDrivenSupported)
+	{
+		glGenBuffers(1, &gpuInstanceBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuInstanceBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, instancesSize, instances.data(), GL_DYNAMIC_DRAW);
+
+		glGenBuffers(1, &gpuBoundsBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuBoundsBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, gpuBounds.size() * sizeof(GpuBounds), gpuBounds.data(), GL_DYNAMIC_DRAW);
+
+		// every view gets room for all instances, each batch keeps its render list range within it
+		std::vector<DrawElementsIndirectCommand> commands;
+		for (GLuint view = 0; view < CULL_VIEW_COUNT; view++)
+		{
+			for (const RenderBatch& batch : renderList.batches)
+			{
+				const Mesh& mesh = meshes[batch.mesh];
+				commands.push_back({ static_cast<GLuint>(mesh.indexCount), 0, mesh.firstIndex, mesh.baseVertex, view * instanceCount + batch.firstInstance });
+			}
+		}
+		GLsizeiptr commandsSize = commands.size() * sizeof(DrawElementsIndirectCommand);
+
+		// copied over commandBuffer before every dispatch to reset the counts
+		glGenBuffers(1, &commandTemplateBuffer);
+		glBindBuffer(GL_COPY_READ_BUFFER, commandTemplateBuffer);
+		glBufferData(GL_COPY_READ_BUFFER, commandsSize, commands.data(), GL_STATIC_DRAW);
+
+		glGenBuffers(1, &commandBuffer);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, commandsSize, nullptr, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+		glGenBuffers(1, &gpuCulledInstanceVbo);
+		glBindBuffer(GL_ARRAY_BUFFER, gpuCulledInstanceVbo);
+		glBufferData(GL_ARRAY_BUFFER, CULL_VIEW_COUNT * instancesSize, nullptr, GL_DYNAMIC_COPY);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_INSTANCES_BINDING, gpuInstanceBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_BOUNDS_BINDING, gpuBoundsBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_COMMANDS_BINDING, commandBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_OUTPUT_BINDING, gpuCulledInstanceVbo);
+	}
+
+	// CLUSTERED LIGHTING
+	// the lights don't move, so their storage, shadow views and atlas tiles are all set up once
+	std::vector<ShadowView> shadowViews;
+	std::vector<ShadowedLight> shadowedLights;
+	ShadowAtlasAllocator shadowAtlasAllocator;
+	std::vector<SceneLight> usedLights(scene.lights.begin(), scene.lights.begin() + std::min(scene.lights.size(), MAX_LOCAL_LIGHTS));
+	// rewritten whenever the atlas assignment is, the rest is fixed
+	std::vector<GpuLight> gpuLights;
+	std::vector<GpuShadowView> gpuShadowViews;
+	ShaderProgram clusterProgram;
+	GLuint localLightBuffer = 0, shadowViewBuffer = 0, clusterLightBuffer = 0;
+	// the atlas assignment changes every frame, so shadowed lights stream their lights and views instead
+	StreamBuffer lightStream;
+	GLuint shadowAtlas = 0, shadowAtlasFbo = 0;
+	GLuint localLightCount = static_cast<GLuint>(std::min(scene.lights.size(), MAX_LOCAL_LIGHTS));
+	if (scene.lights.size() > MAX_LOCAL_LIGHTS)
+	{
+		std::cerr << "Scene has " << scene.lights.size() << " local lights, only the first " << MAX_LOCAL_LIGHTS << " are used" << std::endl;
+	}
+	if (clusteredLightingSupported)
+	{
+		BuildLocalShadowViews(usedLights, shadowViews, shadowedLights);
+
+		// without atlas tiles yet, every light starts out unshadowed
+		for (const SceneLight& light : usedLights)
+		{
+			gpuLights.push_back({ glm::vec4(light.position, light.range), glm::vec4(light.color, 0.0f),
+				glm::vec4(light.direction, light.outerAngle), light.innerAngle, light.type, -1, 0.0f });
+		}
+		for (const ShadowView& view : shadowViews)
+		{
+			gpuShadowViews.push_back({ view.viewProjection, glm::vec4(0.0f) });
+		}
+
+		// zero-sized storage can't be bound, so every buffer holds at least one entry
+		glGenBuffers(1, &localLightBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, localLightBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(gpuLights.size(), 1) * sizeof(GpuLight), nullptr, GL_DYNAMIC_DRAW);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, gpuLights.size() * sizeof(GpuLight), gpuLights.data());
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LOCAL_LIGHTS_BINDING, localLightBuffer);
+
+		glGenBuffers(1, &shadowViewBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, shadowViewBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(gpuShadowViews.size(), 1) * sizeof(GpuShadowView), nullptr, GL_DYNAMIC_DRAW);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, gpuShadowViews.size() * sizeof(GpuShadowView), gpuShadowViews.data());
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SHADOW_VIEWS_BINDING, shadowViewBuffer);
+
+		glGenBuffers(1, &clusterLightBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterLightBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, CLUSTER_COUNT * (MAX_LIGHTS_PER_CLUSTER + 1) * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_LIGHTS_BINDING, clusterLightBuffer);
+
+		if (!shadowedLights.empty())
+		{
+			GLint storageAlignment;
+			glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+			GLsizeiptr lightStreamSize = gpuLights.size() * sizeof(GpuLight) + gpuShadowViews.size() * sizeof(GpuShadowView) + 2 * storageAlignment;
+			if (!CreateStreamBuffer(lightStream, lightStreamSize, storageAlignment))
+			{
+				return 1;
+			}
+		}
+
+		// the atlas is sampled even without shadowed lights, so it always exists.
+		// tiles that are not rendered keep their depth from earlier frames, so it is only cleared here
+		shadowAtlas = CreateShadowAtlas(SHADOW_ATLAS_SIZE);
+		glGenFramebuffers(1, &shadowAtlasFbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, shadowAtlasFbo);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadowAtlas, 0);
+		glDrawBuffer(GL_NONE);
+
+		if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			printf("Shadow atlas framebuffer incomplete...");
+			return 1;
+		}
+		glClear(GL_DEPTH_BUFFER_BIT);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+	// the static shadow cache's views come last, one per cascade, each only culled when its layer is re-rendered
+	const int STATIC_CACHE_VIEW = CULL_VIEW_COUNT + static_cast<int>(shadowViews.size());
+	cullViews.resize(STATIC_CACHE_VIEW + CASCADE_COUNT);
+
+	// instance stream setup, every frame writes the visible instances of all views into its own region.
+	// offsets stay whole instances, so a batch's first instance is simply moved by the region's start.
+	// each view may see every instance, sizing for that keeps the ring from growing mid-frame.
+	// huge generated scenes start smaller and grow on the first frame that needs it
+	const GLsizeiptr INSTANCE_STREAM_REGION_LIMIT = 32 * 1024 * 1024;
+	GLsizeiptr instanceStreamRegionSize = std::min<GLsizeiptr>(cullViews.size() * instancesSize, INSTANCE_STREAM_REGION_LIMIT);
+	StreamBuffer instanceStream;
+	if (!CreateStreamBuffer(instanceStream, std::max<GLsizeiptr>(instanceStreamRegionSize, sizeof(InstanceData)), sizeof(InstanceData)))
+	{
+		return 1;
+	}
+
+	// instanced VAO setup, same vertex layout plus the per-instance model matrix
+	GLuint instancedVao;
+	glGenVertexArrays(1, &instancedVao);
+	glBindVertexArray(instancedVao);
+	SetVertexAttributes(meshLayout, vbo, attributeVbo, ebo, false);
+	SetInstanceAttributes(instanceStream.buffer, INSTANCE_ATTRIBUTE_COUNT);
+	glBindVertexArray(0);
+
+	// instanced depth-only VAO, positions plus the model matrix
+	GLuint depthInstancedVao;
+	glGenVertexArrays(1, &depthInstancedVao);
+	glBindVertexArray(depthInstancedVao);
+	SetVertexAttributes(meshLayout, vbo, attributeVbo, ebo, true);
+	SetInstanceAttributes(instanceStream.buffer, 4);
+	glBindVertexArray(0);
+
+	// FBO setup
+	GLuint fbo;
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+	// Depth Texture, one layer per cascade
+	GLuint depthTextureWidth = benchmark.shadowSize;
+	GLuint depthTextureHeight = benchmark.shadowSize;
+	GLuint depthTexture = CreateShadowMapArray(depthTextureWidth, depthTextureHeight);
+
+	// the cascade being rendered is attached per layer in the render loop
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0, 0);
+	glDrawBuffer(GL_NONE);
+
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		printf("Framebuffer incomplete...");
+		return 1;
+	}
+
+	// layered FBO, every cascade is attached at once and the geometry shader picks the layer
+	GLuint layeredFbo;
+	glGenFramebuffers(1, &layeredFbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, layeredFbo);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0);
+	glDrawBuffer(GL_NONE);
+
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		printf("Layered framebuffer incomplete...");
+		return 1;
+	}
+
+	// STATIC SHADOW CACHE
+	// one layer per cascade, re-rendered only when its cascade leaves the layer's window and read through depthReadSampler.
+	// large cascades can't be scaled up within the texture size limit, the cache is left off for them
+	GLint maxTextureSize;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+	GLuint staticDepthWidth = depthTextureWidth * STATIC_SHADOW_CACHE_SCALE;
+	GLuint staticDepthHeight = depthTextureHeight * STATIC_SHADOW_CACHE_SCALE;
+	bool staticShadowCacheSupported = std::max(staticDepthWidth, staticDepthHeight) <= static_cast<GLuint>(maxTextureSize);
+	GLuint staticDepthTexture = 0;
+	GLuint staticCacheFbo = 0;
+	if (staticShadowCacheSupported)
+	{
+		staticDepthTexture = CreateShadowMapArray(staticDepthWidth, staticDepthHeight);
+
+		// the layer being rendered is attached in the render loop
+		glGenFramebuffers(1, &staticCacheFbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, staticCacheFbo);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, staticDepthTexture, 0, 0);
+		glDrawBuffer(GL_NONE);
+
+		if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			printf("Static shadow cache framebuffer incomplete...");
+			return 1;
+		}
+	}
+
+	// MOMENT SHADOWS
+	// the cascades' depth is resolved into exponential moments, blurred in two passes through momentsBlurTexture
+	// and mipmapped, so main.fsh can replace the PCF taps with one filtered fetch
+	GLuint momentsTexture = CreateMomentsArray(depthTextureWidth, depthTextureHeight, CASCADE_COUNT, true);
+	GLuint momentsBlurTexture = CreateMomentsArray(depthTextureWidth, depthTextureHeight, 1, false);
+
+	// the target layer is attached per pass in the render loop
+	GLuint momentsFbo;
+	glGenFramebuffers(1, &momentsFbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, momentsFbo);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, momentsBlurTexture, 0, 0);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		printf("Shadow moments framebuffer incomplete...");
+		return 1;
+	}
+
+	// reads depthTexture as plain depth values, overriding its comparison mode
+	GLuint depthReadSampler;
+	glGenSamplers(1, &depthReadSampler);
+	glSamplerParameteri(depthReadSampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glSamplerParameteri(depthReadSampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glSamplerParameteri(depthReadSampler, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+
+	// fullscreen.vsh needs no attributes, but the core profile can't draw without a VAO
+	GLuint fullscreenVao;
+	glGenVertexArrays(1, &fullscreenVao);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	// SHADERS
+	// compile-time constants shared by every shader
+	ShaderPermutationCache shaderCache;
+	shaderCache.globalDefines =
+	{
+		"CASCADE_COUNT " + std::to_string(CASCADE_COUNT),
+		"CLUSTER_GRID_X " + std::to_string(CLUSTER_GRID_X),
+		"CLUSTER_GRID_Y " + std::to_string(CLUSTER_GRID_Y),
+		"CLUSTER_GRID_Z " + std::to_string(CLUSTER_GRID_Z),
+		"MAX_LIGHTS_PER_CLUSTER " + std::to_string(MAX_LIGHTS_PER_CLUSTER),
+		"EVSM_EXPONENT " + std::to_string(EVSM_EXPONENT),
+	};
+
+	// PCF kernel, compiled into main.fsh as PCF_TAPS and cycled with P
+	const int pcfKernelTaps[] = { 1, 4, 9, 25 };
+	const int pcfKernelCount = sizeof(pcfKernelTaps) / sizeof(pcfKernelTaps[0]);
+	int pcfKernel = 1;
+	bool pcfKeyWasPressed = false;
+
+	// permutations picked by the render loop toggles
+	auto depthShaderPermutation = [&](bool instanced, bool layered) -> ShaderProgram&
+	{
+		ShaderDefines defines;
+		if (instanced)
+		{
+			defines.push_back("INSTANCED");
+		}
+		return GetShaderPermutation(shaderCache, "depth.vsh", "depth.fsh", layered ? "depth.gsh" : "", defines);
+	};
+	// depth.vsh from the camera, writes the depth the main pass then only shades once per pixel
+	auto cameraDepthShaderPermutation = [&](bool instanced) -> ShaderProgram&
+	{
+		ShaderDefines defines = { "CAMERA_DEPTH" };
+		if (instanced)
+		{
+			defines.push_back("INSTANCED");
+		}
+		return GetShaderPermutation(shaderCache, "depth.vsh", "depth.fsh", "", defines);
+	};
+	// depth.vsh for one local light view in the shadow atlas, or the static shadow cache's region
+	auto localShadowShaderPermutation = [&](bool instanced) -> ShaderProgram&
+	{
+		ShaderDefines defines = { "LOCAL_SHADOW" };
+		if (instanced)
+		{
+			defines.push_back("INSTANCED");
+		}
+		return GetShaderPermutation(shaderCache, "depth.vsh", "depth.fsh", "", defines);
+	};
+	// moment shadows ignore the PCF kernel, so they share one permutation
+	auto mainShaderPermutation = [&](bool instanced, int kernel, bool moments) -> ShaderProgram&
+	{
+		ShaderDefines defines;
+		if (moments)
+		{
+			defines.push_back("MOMENT_SHADOWS");
+		}
+		else
+		{
+			defines.push_back("PCF_TAPS " + std::to_string(pcfKernelTaps[kernel]));
+		}
+		if (instanced)
+		{
+			defines.push_back("INSTANCED");
+		}
+		if (clusteredLightingSupported)
+		{
+			defines.push_back("CLUSTERED_LIGHTING");
+		}
+		return GetShaderPermutation(shaderCache, "main.vsh", "main.fsh", "", defines);
+	};
+	// one half of the moments blur, the horizontal half also converts the depth
+	auto momentsBlurShaderPermutation = [&](bool depthInput) -> ShaderProgram&
+	{
+		ShaderDefines defines;
+		if (depthInput)
+		{
+			defines.push_back("DEPTH_INPUT");
+		}
+		return GetShaderPermutation(shaderCache, "fullscreen.vsh", "moments.fsh", "", defines);
+	};
+	// fills a cascade from the static shadow cache
+	auto shadowCacheShaderPermutation = [&]() -> ShaderProgram&
+	{
+		return GetShaderPermutation(shaderCache, "fullscreen.vsh", "shadowcache.fsh", "", {});
+	};
+
+	// submit every permutation up front, the driver compiles them in the background
+	// and toggling only waits if a build still hasn't finished
+	for (int instanced = 0; instanced < 2; instanced++)
+	{
+		depthShaderPermutation(instanced, false);
+		depthShaderPermutation(instanced, true);
+		cameraDepthShaderPermutation(instanced);
+		localShadowShaderPermutation(instanced);
+		for (int kernel = 0; kernel < pcfKernelCount; kernel++)
+		{
+			mainShaderPermutation(instanced, kernel, false);
+		}
+		mainShaderPermutation(instanced, 0, true);
+	}
+	momentsBlurShaderPermutation(true);
+	momentsBlurShaderPermutation(false);
+	shadowCacheShaderPermutation();
+	if (gpuDrivenSupported)
+	{
+		SubmitComputeProgram(cullProgram, "cull.csh", shaderCache.globalDefines);
+	}
+	if (clusteredLightingSupported)
+	{
+		SubmitComputeProgram(clusterProgram, "cluster.csh", shaderCache.globalDefines);
+	}
+
+	// UBO setup, every uniform block is rewritten once per frame into the uniform stream and bound by range
+	GLint uniformAlignment;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+	GLsizeiptr uniformStreamSize = sizeof(PerFrameUniforms) + sizeof(LightsUniforms) + sizeof(ClusteringUniforms) + sizeof(CullingUniforms)
+		+ 4 * uniformAlignment;
+	StreamBuffer uniformStream;
+	if (!CreateStreamBuffer(uniformStream, uniformStreamSize, uniformAlignment))
+	{
+		return 1;
+	}
+
+	// toggled with I
+	bool instancedRendering = true;
+	bool instancingKeyWasPressed = false;
+	// toggled with G, culls on the GPU and draws every pass with one indirect multi-draw, always instanced
+	bool gpuDrivenRendering = false;
+	bool gpuDrivenKeyWasPressed = false;
+	// toggled with L, renders every cascade in one submission instead of one per cascade
+	bool layeredShadowPass = true;
+	bool layeredKeyWasPressed = false;
+	// toggled with Z, lays down the camera's depth first so main.fsh runs only for visible fragments
+	bool depthPrePass = true;
+	bool depthPrePassKeyWasPressed = false;
+	// toggled with V, filters the cascades as blurred exponential variance shadow maps instead of PCF
+	bool momentShadows = false;
+	bool momentShadowsKeyWasPressed = false;
+	// toggled with C, caches the static casters' depth between frames
+	bool staticShadowCache = staticShadowCacheSupported;
+	bool shadowCacheKeyWasPressed = false;
+	// toggled with R, appends every profiled section's samples to PROFILER_CSV_FILE
+	bool profileKeyWasPressed = false;
+	// toggled with B, trades shadow resolution and refresh rate for staying within the shadow passes' GPU budget
+	ShadowQualityController shadowQualityController = { !benchmark.enabled && benchmark.shadowBudget > 0.0f, benchmark.shadowBudget, 0, 0 };
+	bool shadowQualityKeyWasPressed = false;
+	// set whenever the static casters change, forces every layer of the cache to be rebuilt
+	bool staticShadowCacheDirty = true;
+	GLuint cachedShadowRenderWidth = 0;
+	glm::mat4 staticShadowWindows[CASCADE_COUNT];
+	// layers re-rendered this frame
+	bool rebuiltStaticShadowWindows[CASCADE_COUNT] = {};
+
+	// glViewport(0, 0, windowWidth, windowHeight);
+
+	glEnable(GL_DEPTH_TEST);
+
+
+	// camera and movement
+	GLfloat horizontalAngle = M_PI;
+	GLfloat verticalAngle = 0.0f;
+	GLfloat speed = 4.0f;
+	GLfloat mouseSensitivity = 0.0025f;	// radians per pixel
+	glm::vec3 direction, right, up;
+
+	// starting view position
+	glm::vec3 position(0.0f, 3.0f, 5.0f);
+
+	// a disabled cursor reports unbounded motion without being warped back every frame,
+	// raw motion also skips the OS pointer acceleration where it's available
+	GLdouble lastCursorX = 0.0, lastCursorY = 0.0;
+	if (!benchmark.enabled)
+	{
+		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+		if (glfwRawMouseMotionSupported())
+		{
+			glfwSetInputMode(window, GLFW_RAW_MOUSE_MOTION, GLFW_TRUE);
+		}
+		glfwGetCursorPos(window, &lastCursorX, &lastCursorY);
+	}
+
+	// SIMULATION
+	SimulationState simulation = { position, horizontalAngle, verticalAngle, 0.0f };
+	SimulationState previousSimulation = simulation;
+	GLfloat simulationAccumulator = 0.0f;
+
+	// FRAME LIMITER
+	std::chrono::steady_clock::time_point frameDeadline = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::duration frameInterval = std::chrono::steady_clock::duration::zero();
+	if (!benchmark.enabled && framePacing.frameRateLimit > 0.0f)
+	{
+		frameInterval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / framePacing.frameRateLimit));
+	}
+
+	GLfloat lastTime = glfwGetTime();
+
+	// camera projection
+	GLfloat fieldOfView = glm::radians(90.0f);
+	GLfloat nearPlane = 0.1f;
+	GLfloat farPlane = 100.0f;
+
+	// DIRECTIONAL LIGHT
+	glm::vec3 directionalLightDirection(-1.0f, -1.0f, 1.0f);
+	glm::vec3 directionalLightAmbient(1.0f, 1.0f, 1.0f);
+	glm::vec3 directionalLightDiffuse(0.75f, 0.75f, 0.75f);
+	glm::vec3 directionalLightSpecular(0.5f, 0.5f, 0.5f);
+	glm::mat4 cascadeViewProjections[CASCADE_COUNT];
+	GLfloat cascadeSplits[CASCADE_COUNT];
+
+	// the setup above bound plenty without the cache, so it starts out knowing nothing
+	GlStateCache glState;
+	InvalidateGlStateCache(glState);
+
+	// counts rendered frames, for the shadow atlas refresh intervals
+	uint64_t frame = 0;
+	// per shadow view, whether its light's tiles are rendered this frame
+	std::vector<uint8_t> renderedShadowViews(shadowViews.size(), 0);
+
+	// BENCHMARK
+	// the second pass renders into sceneFbo, which is the window's framebuffer outside the benchmark.
+	// a hidden window's own framebuffer may fail the pixel ownership test and skip shading, which would skew the timings
+	GLuint sceneFbo = 0, sceneColorRenderbuffer = 0, sceneDepthRenderbuffer = 0;
+	std::vector<BenchmarkConfiguration> benchmarkConfigurations;
+	int framesPerConfiguration = BENCHMARK_WARMUP_FRAMES + benchmark.frames;
+	GLfloat benchmarkOrbitRadius = BenchmarkOrbitRadius(scene.objects.size(), sceneFileObjectCount);
+	// the latest frame whose GPU time has been handed to its configuration
+	uint64_t lastBenchmarkGpuFrame = 0;
+	if (benchmark.enabled)
+	{
+		glGenRenderbuffers(1, &sceneColorRenderbuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, sceneColorRenderbuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, windowWidth, windowHeight);
+		glGenRenderbuffers(1, &sceneDepthRenderbuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, sceneDepthRenderbuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, windowWidth, windowHeight);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		glGenFramebuffers(1, &sceneFbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, sceneFbo);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, sceneColorRenderbuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, sceneDepthRenderbuffer);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			printf("Benchmark framebuffer incomplete...");
+			return 1;
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		// per-object, instanced and GPU-driven submission under every PCF kernel
+		for (int kernel = 0; kernel < pcfKernelCount; kernel++)
+		{
+			benchmarkConfigurations.push_back({ kernel, false, false, {}, {} });
+			benchmarkConfigurations.push_back({ kernel, true, false, {}, {} });
+			if (gpuDrivenSupported)
+			{
+				benchmarkConfigurations.push_back({ kernel, true, true, {}, {} });
+			}
+		}
+
+		// every configuration sees the same textures
+		WaitForJobs(textureLoader.jobs, textureLoader.pending);
+		while (UploadLoadedTextures(textureLoader, glState))
+		{
+		}
+	}
+
+	// FRAME PROFILER
+	// per section GPU and CPU times, summarized in the window title twice a second
+	FrameProfiler profiler;
+	CreateFrameProfiler(profiler);
+	const GLfloat profileTitleInterval = 0.5f;
+	GLfloat lastProfileTitleTime = lastTime;
+
+	// Render loop
+	while (!glfwWindowShouldClose(window))
+	{
+		frame++;
+		BeginProfileFrame(profiler, frame);
+		BeginProfileSection(profiler, PROFILE_FRAME);
+		std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+		GLfloat currentTime = glfwGetTime();
+		GLfloat deltaTime = currentTime - lastTime;
+		lastTime = currentTime;
+		// drives the animations, the benchmark replaces the wall clock with fixed steps
+		GLfloat simulationTime = currentTime;
+
+		PollShaderPermutations(shaderCache);
+
+		// STREAMING BUFFERS
+		// this frame writes the regions used three frames ago, which usually finished long since
+		BeginStreamFrame(instanceStream);
+		BeginStreamFrame(uniformStream);
+		if (lightStream.buffer != 0)
+		{
+			BeginStreamFrame(lightStream);
+		}
+
+		// MATERIAL TEXTURES
+		UploadLoadedTextures(textureLoader, glState);
+
+		// every configuration replays the same path from the start, after the last one a warm-up's worth
+		// of frames lets its final queries resolve
+		int benchmarkConfiguration = 0;
+		bool benchmarkMeasuring = false;
+		if (benchmark.enabled)
+		{
+			int benchmarkFrame = static_cast<int>(frame - 1);
+			int configurationCount = static_cast<int>(benchmarkConfigurations.size());
+			if (benchmarkFrame >= configurationCount * framesPerConfiguration + BENCHMARK_WARMUP_FRAMES)
+			{
+				glfwSetWindowShouldClose(window, GLFW_TRUE);
+			}
+			benchmarkConfiguration = std::min(benchmarkFrame / framesPerConfiguration, configurationCount - 1);
+			int configurationFrame = benchmarkFrame - benchmarkConfiguration * framesPerConfiguration;
+			benchmarkMeasuring = configurationFrame >= BENCHMARK_WARMUP_FRAMES && configurationFrame < framesPerConfiguration;
+
+			const BenchmarkConfiguration& configuration = benchmarkConfigurations[benchmarkConfiguration];
+			pcfKernel = configuration.pcfKernel;
+			instancedRendering = configuration.instanced;
+			gpuDrivenRendering = configuration.gpuDriven;
+
+			simulationTime = configurationFrame * BENCHMARK_TIMESTEP;
+			BenchmarkCameraPath(simulationTime, benchmarkOrbitRadius, position, horizontalAngle, verticalAngle);
+		}
+		else
+		{
+			//camera movement
+			// mouse look goes into both states right away, so it never waits for the next step
+			GLdouble cursorX, cursorY;
+			glfwGetCursorPos(window, &cursorX, &cursorY);
+			GLfloat lookX = mouseSensitivity * float(lastCursorX - cursorX);
+			GLfloat lookY = mouseSensitivity * float(lastCursorY - cursorY);
+			lastCursorX = cursorX;
+			lastCursorY = cursorY;
+			simulation.horizontalAngle += lookX;
+			simulation.verticalAngle += lookY;
+			previousSimulation.horizontalAngle = simulation.horizontalAngle;
+			previousSimulation.verticalAngle = simulation.verticalAngle;
+
+			simulationAccumulator += std::min(deltaTime, MAX_SIMULATION_STEPS * SIMULATION_TIMESTEP);
+			while (simulationAccumulator >= SIMULATION_TIMESTEP)
+			{
+				previousSimulation = simulation;
+				StepSimulation(window, simulation, SIMULATION_TIMESTEP, speed);
+				simulationAccumulator -= SIMULATION_TIMESTEP;
+			}
+
+			// rendered between the last two steps, so motion stays smooth when the frame and step rates differ
+			GLfloat alpha = simulationAccumulator / SIMULATION_TIMESTEP;
+			position = glm::mix(previousSimulation.position, simulation.position, alpha);
+			horizontalAngle = simulation.horizontalAngle;
+			verticalAngle = simulation.verticalAngle;
+			simulationTime = glm::mix(previousSimulation.time, simulation.time, alpha);
+		}
+
+		CameraBasis(horizontalAngle, verticalAngle, direction, right, up);
+
+		// the benchmark sets the toggles itself
+		if (!benchmark.enabled)
+		{
+			if (KeyPressedOnce(window, GLFW_KEY_I, instancingKeyWasPressed)) {
+				instancedRendering = !instancedRendering;
+			}
+			if (KeyPressedOnce(window, GLFW_KEY_G, gpuDrivenKeyWasPressed) && gpuDrivenSupported) {
+				gpuDrivenRendering = !gpuDrivenRendering;
+			}
+			if (KeyPressedOnce(window, GLFW_KEY_L, layeredKeyWasPressed)) {
+				layeredShadowPass = !layeredShadowPass;
+			}
+			if (KeyPressedOnce(window, GLFW_KEY_P, pcfKeyWasPressed)) {
+				pcfKernel = (pcfKernel + 1) % pcfKernelCount;
+			}
+			if (KeyPressedOnce(window, GLFW_KEY_Z, depthPrePassKeyWasPressed)) {
+				depthPrePass = !depthPrePass;
+			}
+			if (KeyPressedOnce(window, GLFW_KEY_V, momentShadowsKeyWasPressed)) {
+				momentShadows = !momentShadows;
+				// the moments pass comes or goes, so the samples so far no longer describe the shadow cost
+				shadowQualityController.levelFrame = frame;
+			}
+			if (KeyPressedOnce(window, GLFW_KEY_C, shadowCacheKeyWasPressed) && staticShadowCacheSupported) {
+				staticShadowCache = !staticShadowCache;
+				staticShadowCacheDirty = true;
+			}
+			if (KeyPressedOnce(window, GLFW_KEY_B, shadowQualityKeyWasPressed) && shadowQualityController.budgetMilliseconds > 0.0f) {
+				shadowQualityController.enabled = !shadowQualityController.enabled;
+				shadowQualityController.level = 0;
+				shadowQualityController.levelFrame = frame;
+			}
+			if (KeyPressedOnce(window, GLFW_KEY_R, profileKeyWasPressed)) {
+				if (profiler.csv.is_open())
+				{
+					StopProfileRecording(profiler);
+				}
+				else
+				{
+					StartProfileRecording(profiler, PROFILER_CSV_FILE);
+				}
+			}
+		}
+
+
+		// MVP uniforms
+		glm::mat4 viewMatrix = glm::lookAt(position, position + direction, up);
+		glm::mat4 projectionMatrix = glm::perspective(fieldOfView, windowWidth / windowHeight, nearPlane, farPlane);
+
+		// ADAPTIVE SHADOW QUALITY
+		// the cascades render into the lower left shadowRenderWidth x shadowRenderHeight of their layers
+		UpdateShadowQuality(shadowQualityController, profiler, frame);
+		const ShadowQualityLevel& shadowQuality = SHADOW_QUALITY_LEVELS[shadowQualityController.level];
+		GLuint shadowRenderWidth = std::max(1u, static_cast<GLuint>(depthTextureWidth * shadowQuality.resolutionScale));
+		GLuint shadowRenderHeight = std::max(1u, static_cast<GLuint>(depthTextureHeight * shadowQuality.resolutionScale));
+
+		// fit the cascades to the camera frustum
+		ComputeShadowCascades(viewMatrix, fieldOfView, windowWidth / windowHeight, nearPlane,
+			directionalLightDirection, shadowRenderWidth, cascadeViewProjections, cascadeSplits);
+
+		// ANIMATE OBJECTS
+		// only these get their matrices rebuilt below, everything else keeps last frame's
+		for (const Animation& animation : renderList.animations)
+		{
+			transforms.SetRotation(animation.transform, animation.baseRotation * glm::angleAxis(glm::radians(simulationTime * animation.speed), animation.axis));
+		}
+		ParallelFor(jobs, transforms.Size(), TRANSFORM_UPDATE_GRAIN, [&](size_t first, size_t last)
+		{
+			UpdateWorldMatrices(transforms, instances.data(), first, last);
+		});
+		ParallelFor(jobs, renderList.animations.size(), TRANSFORM_UPDATE_GRAIN, [&](size_t first, size_t last)
+		{
+			for (size_t i = first; i < last; i++)
+			{
+				UpdateWorldBounds(renderList, meshes, renderList.animations[i].transform);
+			}
+		});
+		if (!renderList.animations.empty())
+		{
+			RefitBvh(renderList.bvh, renderList.bounds);
+		}
+
+		// the GPU-driven path reads its instances through the same attributes
+		bool instancedShaders = instancedRendering || gpuDrivenRendering;
+		ShaderProgram& activeDepthShader = depthShaderPermutation(instancedShaders, layeredShadowPass);
+		ShaderProgram& activeMainShader = mainShaderPermutation(instancedShaders, pcfKernel, momentShadows);
+
+		// CULL
+		BeginProfileSection(profiler, PROFILE_CULL);
+		// receivers against the camera, casters against the cascades they are drawn into, every view in its own job.
+		// each view sorts its draws front to back, the camera along the view direction and the cascades along the light
+		glm::vec3 lightDirection = glm::normalize(directionalLightDirection);
+		cullViews[CAMERA_VIEW].frustums[0] = FrustumFromViewProjection(projectionMatrix * viewMatrix);
+		cullViews[CAMERA_VIEW].frustumCount = 1;
+		cullViews[CAMERA_VIEW].pass = RENDER_PASS_MAIN;
+		cullViews[CAMERA_VIEW].program = activeMainShader.id;
+		cullViews[CAMERA_VIEW].depthPlane = glm::vec4(direction, -glm::dot(direction, position));
+		for (int cascade = 0; cascade < CASCADE_COUNT; cascade++)
+		{
+			Frustum cascadeFrustum = FrustumFromViewProjection(cascadeViewProjections[cascade]);
+			cullViews[1 + cascade].frustums[0] = cascadeFrustum;
+			cullViews[1 + cascade].frustumCount = 1;
+			// the layered pass draws every cascade from one list, so it takes the union
+			cullViews[LAYERED_VIEW].frustums[cascade] = cascadeFrustum;
+		}
+		cullViews[LAYERED_VIEW].frustumCount = CASCADE_COUNT;
+		for (int i = 1; i < CULL_VIEW_COUNT; i++)
+		{
+			cullViews[i].pass = RENDER_PASS_SHADOW;
+			cullViews[i].program = activeDepthShader.id;
+			cullViews[i].depthPlane = glm::vec4(lightDirection, 0.0f);
+		}
+		// hand out this frame's atlas tiles, then point the lights at them
+		if (!shadowedLights.empty())
+		{
+			GLfloat screenScale = windowHeight / (2.0f * std::tan(fieldOfView / 2.0f));
+			AssignShadowAtlas(shadowAtlasAllocator, shadowedLights, shadowViews, usedLights, cullViews[CAMERA_VIEW].frustums[0], position, screenScale, frame,
+				shadowQuality.refreshScale);
+			for (const ShadowedLight& shadowed : shadowedLights)
+			{
+				gpuLights[shadowed.light].shadowView = shadowed.tileSize > 0 ? static_cast<GLint>(shadowed.firstView) : -1;
+				for (GLuint i = shadowed.firstView; i < shadowed.firstView + shadowed.viewCount; i++)
+				{
+					const ShadowView& view = shadowViews[i];
+					gpuShadowViews[i].atlasRect = glm::vec4(view.x, view.y, view.size, view.size) / static_cast<GLfloat>(SHADOW_ATLAS_SIZE);
+					renderedShadowViews[i] = shadowed.render;
+				}
+			}
+			StreamBufferRange(glState, lightStream, GL_SHADER_STORAGE_BUFFER, LOCAL_LIGHTS_BINDING, gpuLights.data(), gpuLights.size() * sizeof(GpuLight));
+			StreamBufferRange(glState, lightStream, GL_SHADER_STORAGE_BUFFER, SHADOW_VIEWS_BINDING, gpuShadowViews.data(), gpuShadowViews.size() * sizeof(GpuShadowView));
+		}
+
+		// a cache layer is re-centered on its cascade once the cascade leaves its window, its texel grid changes with the
+		// rendered size, or the static casters change. a new light direction or radius fails the window check too
+		if (staticShadowCache && cachedShadowRenderWidth != shadowRenderWidth)
+		{
+			staticShadowCacheDirty = true;
+			cachedShadowRenderWidth = shadowRenderWidth;
+		}
+		for (int cascade = 0; cascade < CASCADE_COUNT; cascade++)
+		{
+			rebuiltStaticShadowWindows[cascade] = staticShadowCache &&
+				(staticShadowCacheDirty || !StaticShadowWindowCovers(staticShadowWindows[cascade], cascadeViewProjections[cascade]));
+			if (rebuiltStaticShadowWindows[cascade])
+			{
+				staticShadowWindows[cascade] = ComputeStaticShadowWindow(cascadeViewProjections[cascade]);
+				CullView& view = cullViews[STATIC_CACHE_VIEW + cascade];
+				view.frustums[0] = FrustumFromViewProjection(staticShadowWindows[cascade]);
+				view.frustumCount = 1;
+				view.pass = RENDER_PASS_SHADOW;
+				view.program = localShadowShaderPermutation(instancedShaders).id;
+				view.depthPlane = glm::vec4(lightDirection, 0.0f);
+			}
+		}
+		staticShadowCacheDirty = staticShadowCacheDirty && !staticShadowCache;
+
+		// local shadow views are perspective, so their casters are sorted by distance along the view
+		ShaderProgram* activeLocalShadowShader = shadowViews.empty() ? nullptr : &localShadowShaderPermutation(instancedShaders);
+		for (size_t i = 0; i < shadowViews.size(); i++)
+		{
+			CullView& view = cullViews[CULL_VIEW_COUNT + i];
+			view.frustums[0] = FrustumFromViewProjection(shadowViews[i].viewProjection);
+			view.frustumCount = 1;
+			view.pass = RENDER_PASS_SHADOW;
+			view.program = activeLocalShadowShader->id;
+			view.depthPlane = glm::vec4(shadowViews[i].forward, -glm::dot(shadowViews[i].forward, shadowViews[i].position));
+		}
+
+		if (gpuDrivenRendering)
+		{
+			// only the animated instances and their bounds changed since the last upload
+			GLuint dynamicCount = instanceCount - firstDynamicInstance;
+			for (GLuint i = firstDynamicInstance; i < instanceCount; i++)
+			{
+				gpuBounds[i].min = glm::vec4(renderList.bounds[i].min, gpuBounds[i].min.w);
+				gpuBounds[i].max = glm::vec4(renderList.bounds[i].max, 0.0f);
+			}
+			if (dynamicCount > 0)
+			{
+				BindBuffer(glState, GL_SHADER_STORAGE_BUFFER, gpuInstanceBuffer);
+				glBufferSubData(GL_SHADER_STORAGE_BUFFER, firstDynamicInstance * sizeof(InstanceData), dynamicCount * sizeof(InstanceData), &instances[firstDynamicInstance]);
+				BindBuffer(glState, GL_SHADER_STORAGE_BUFFER, gpuBoundsBuffer);
+				glBufferSubData(GL_SHADER_STORAGE_BUFFER, firstDynamicInstance * sizeof(GpuBounds), dynamicCount * sizeof(GpuBounds), &gpuBounds[firstDynamicInstance]);
+			}
+
+			CullingUniforms cullingUniforms;
+			cullingUniforms.viewMask = 0;
+			for (int i = 0; i < CULL_VIEW_COUNT; i++)
+			{
+				if (i == CAMERA_VIEW || (i == LAYERED_VIEW) == layeredShadowPass)
+				{
+					cullingUniforms.viewMask |= 1u << i;
+				}
+				for (int frustum = 0; frustum < cullViews[i].frustumCount; frustum++)
+				{
+					std::copy(cullViews[i].frustums[frustum].planes, cullViews[i].frustums[frustum].planes + 6,
+						cullingUniforms.frustumPlanes + (i * CASCADE_COUNT + frustum) * 6);
+				}
+				cullingUniforms.frustumCounts[i] = glm::ivec4(cullViews[i].frustumCount, 0, 0, 0);
+			}
+			cullingUniforms.instanceCount = instanceCount;
+			cullingUniforms.batchCount = batchCount;
+			StreamBufferRange(glState, uniformStream, GL_UNIFORM_BUFFER, CULLING_UNIFORM_BINDING, &cullingUniforms, sizeof(cullingUniforms));
+
+			// reset the instance counts, then let every instance append itself to the views it is visible in
+			glBindBuffer(GL_COPY_READ_BUFFER, commandTemplateBuffer);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, commandBuffer);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, CULL_VIEW_COUNT * batchCount * sizeof(DrawElementsIndirectCommand));
+			cullProgram.Use(glState);
+			glDispatchCompute((instanceCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+			glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+			BindBuffer(glState, GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+		}
+
+		// the GPU-driven path has culled the fixed views already, the local shadow views due this frame are always culled here
+		JobCounter cullJobs(0);
+		for (int i = 0; i < static_cast<int>(cullViews.size()); i++)
+		{
+			bool needed = i >= STATIC_CACHE_VIEW ? rebuiltStaticShadowWindows[i - STATIC_CACHE_VIEW]
+				: i >= CULL_VIEW_COUNT ? renderedShadowViews[i - CULL_VIEW_COUNT] != 0
+				: !gpuDrivenRendering && (i == CAMERA_VIEW || (i == LAYERED_VIEW) == layeredShadowPass);
+			cullViews[i].batches.clear();
+			cullViews[i].queue.clear();
+			if (needed)
+			{
+				SubmitJob(jobs, cullJobs, [&, i]() { RunCullView(renderList, cullViews[i]); });
+			}
+		}
+		WaitForJobs(jobs, cullJobs);
+
+		// concatenate the views into one instance upload, moving their batches along
+		culledInstances.clear();
+		for (CullView& view : cullViews)
+		{
+			GLuint base = static_cast<GLuint>(culledInstances.size());
+			culledInstances.insert(culledInstances.end(), view.instances.begin(), view.instances.end());
+			for (RenderBatch& batch : view.batches)
+			{
+				batch.firstInstance += base;
+			}
+			view.instances.clear();
+		}
+
+		// write this frame's visible instances into the instance stream, the batches are offset by where they landed
+		GLuint instanceStreamBase = 0;
+		if (instancedShaders)
+		{
+			GLintptr instanceOffset = StreamData(glState, instanceStream, culledInstances.data(), culledInstances.size() * sizeof(InstanceData));
+			instanceStreamBase = static_cast<GLuint>(std::max<GLintptr>(instanceOffset, 0) / sizeof(InstanceData));
+		}
+
+		// upload this frame's camera and light data, shared by both passes
+		PerFrameUniforms perFrameUniforms;
+		perFrameUniforms.view = viewMatrix;
+		perFrameUniforms.projection = projectionMatrix;
+		perFrameUniforms.viewPosition = glm::vec4(position, 1.0f);
+		StreamBufferRange(glState, uniformStream, GL_UNIFORM_BUFFER, PER_FRAME_UNIFORM_BINDING, &perFrameUniforms, sizeof(perFrameUniforms));
+
+		LightsUniforms lightsUniforms;
+		for (int i = 0; i < CASCADE_COUNT; i++)
+		{
+			lightsUniforms.lightViewProjection[i] = cascadeViewProjections[i];
+			lightsUniforms.cascadeSplits[i] = cascadeSplits[i];
+		}
+		lightsUniforms.directionalLightDirection = glm::vec4(directionalLightDirection, 0.0f);
+		lightsUniforms.directionalLightAmbient = glm::vec4(directionalLightAmbient, 0.0f);
+		lightsUniforms.directionalLightDiffuse = glm::vec4(directionalLightDiffuse, 0.0f);
+		lightsUniforms.directionalLightSpecular = glm::vec4(directionalLightSpecular, 0.0f);
+		lightsUniforms.shadowMapScale = glm::vec4(static_cast<GLfloat>(shadowRenderWidth) / depthTextureWidth, 0.0f, 0.0f, 0.0f);
+		StreamBufferRange(glState, uniformStream, GL_UNIFORM_BUFFER, LIGHTS_UNIFORM_BINDING, &lightsUniforms, sizeof(lightsUniforms));
+
+		// bin the local lights into this frame's clusters, read by the second pass
+		if (clusteredLightingSupported)
+		{
+			ClusteringUniforms clusteringUniforms;
+			clusteringUniforms.inverseProjection = glm::inverse(projectionMatrix);
+			clusteringUniforms.clusterParams = glm::vec4(windowWidth / CLUSTER_GRID_X, windowHeight / CLUSTER_GRID_Y, nearPlane, farPlane);
+			clusteringUniforms.localLightCount = localLightCount;
+			StreamBufferRange(glState, uniformStream, GL_UNIFORM_BUFFER, CLUSTERING_UNIFORM_BINDING, &clusteringUniforms, sizeof(clusteringUniforms));
+
+			clusterProgram.Use(glState);
+			glDispatchCompute((CLUSTER_COUNT + CLUSTER_GROUP_SIZE - 1) / CLUSTER_GROUP_SIZE, 1, 1);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		}
+		EndProfileSection(profiler, PROFILE_CULL);
+
+
+		// draws the given casters of a culled view with the given program, which must already be in use
+		auto drawScene = [&](ShaderProgram& shader, ShadowCasters casters, int view)
+		{
+			bool drawStatic = casters != ShadowCasters::Dynamic;
+			bool drawDynamic = casters != ShadowCasters::Static;
+			if (gpuDrivenRendering && view < CULL_VIEW_COUNT)
+			{
+				// static batches come first, so any caster set is one contiguous range of the view's commands
+				GLuint first = drawStatic ? 0 : staticBatchCount;
+				GLuint last = drawDynamic ? batchCount : staticBatchCount;
+				BindBuffer(glState, GL_ARRAY_BUFFER, gpuCulledInstanceVbo);
+				BindInstanceAttributes(0);
+				if (last > first)
+				{
+					GLintptr offset = (view * batchCount + first) * sizeof(DrawElementsIndirectCommand);
+					glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, reinterpret_cast<const void*>(offset), last - first, 0);
+					CountProfileDraw(profiler, 0);
+				}
+				return;
+			}
+
+			if (instancedShaders)
+			{
+				BindBuffer(glState, GL_ARRAY_BUFFER, instanceStream.buffer);
+			}
+			// sorted by RunCullView, the filter keeps the order
+			for (const DrawItem& item : cullViews[view].queue)
+			{
+				const RenderBatch& batch = cullViews[view].batches[item.batch];
+				if (batch.dynamic ? !drawDynamic : !drawStatic)
+				{
+					continue;
+				}
+				const Mesh& mesh = meshes[batch.mesh];
+				const void* indices = reinterpret_cast<const void*>(mesh.firstIndex * sizeof(GLuint));
+				if (instancedShaders)
+				{
+					BindInstanceAttributes(instanceStreamBase + batch.firstInstance);
+					glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT, indices, batch.instanceCount, mesh.baseVertex);
+					CountProfileDraw(profiler, GLuint64(mesh.indexCount / 3) * batch.instanceCount);
+				}
+				else
+				{
+					// same instance data, one uniform upload and draw per object
+					const ShaderProgram::ObjectUniforms& objectUniforms = shader.objectUniforms;
+					for (GLuint i = batch.firstInstance; i < batch.firstInstance + batch.instanceCount; i++)
+					{
+						shader.SetMat4(objectUniforms.model, culledInstances[i].model);
+						shader.SetMat3(objectUniforms.normalMatrix, NormalMatrixOf(culledInstances[i]));
+						shader.SetVec4(objectUniforms.material, culledInstances[i].material);
+						shader.SetFloat(objectUniforms.textureLayer, culledInstances[i].textureParams.x);
+						glDrawElementsBaseVertex(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT, indices, mesh.baseVertex);
+						CountProfileDraw(profiler, mesh.indexCount / 3);
+					}
+				}
+			}
+		};
+
+		// renders casters into every cascade of the target texture, either in one layered submission or one per cascade
+		auto drawShadowCasters = [&](ShadowCasters casters, GLuint targetLayeredFbo, GLuint targetTexture, bool clear)
+		{
+			if (layeredShadowPass)
+			{
+				glBindFramebuffer(GL_FRAMEBUFFER, targetLayeredFbo);
+				if (clear)
+				{
+					glClear(GL_DEPTH_BUFFER_BIT);
+				}
+				drawScene(activeDepthShader, casters, LAYERED_VIEW);
+			}
+			else
+			{
+				glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+				for (int cascade = 0; cascade < CASCADE_COUNT; cascade++)
+				{
+					glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, targetTexture, 0, cascade);
+					if (clear)
+					{
+						glClear(GL_DEPTH_BUFFER_BIT);
+					}
+					activeDepthShader.SetInt("cascadeIndex", cascade);
+					drawScene(activeDepthShader, casters, 1 + cascade);
+				}
+			}
+		};
+
+
+		// FIRST PASS
+		BeginProfileSection(profiler, PROFILE_SHADOW_PASS);
+		BindVertexArray(glState, instancedShaders ? depthInstancedVao : depthVao);
+
+		// DRAW 📝
+		if (staticShadowCache)
+		{
+			// the layers render into the lower left of their texture like the cascades, scaled up by the same factor
+			GLuint cacheRenderWidth = shadowRenderWidth * STATIC_SHADOW_CACHE_SCALE;
+			GLuint cacheRenderHeight = shadowRenderHeight * STATIC_SHADOW_CACHE_SCALE;
+			ShaderProgram& staticCacheShader = localShadowShaderPermutation(instancedShaders);
+			glBindFramebuffer(GL_FRAMEBUFFER, staticCacheFbo);
+			glViewport(0, 0, cacheRenderWidth, cacheRenderHeight);
+			for (int cascade = 0; cascade < CASCADE_COUNT; cascade++)
+			{
+				if (!rebuiltStaticShadowWindows[cascade])
+				{
+					continue;
+				}
+				staticCacheShader.Use(glState);
+				staticCacheShader.SetMat4("shadowViewProjection", staticShadowWindows[cascade]);
+				glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, staticDepthTexture, 0, cascade);
+				glClear(GL_DEPTH_BUFFER_BIT);
+				drawScene(staticCacheShader, ShadowCasters::Static, STATIC_CACHE_VIEW + cascade);
+			}
+
+			// fill each cascade from its layer, then add the dynamic casters on top
+			ShaderProgram& shadowCacheShader = shadowCacheShaderPermutation();
+			shadowCacheShader.Use(glState);
+			BindVertexArray(glState, fullscreenVao);
+			BindTexture(glState, 0, GL_TEXTURE_2D_ARRAY, staticDepthTexture);
+			glBindSampler(0, depthReadSampler);
+			shadowCacheShader.SetInt("staticDepth", 0);
+			shadowCacheShader.SetVec2("renderSize", glm::vec2(shadowRenderWidth, shadowRenderHeight));
+			shadowCacheShader.SetVec2("cacheScale", glm::vec2(static_cast<GLfloat>(cacheRenderWidth) / staticDepthWidth,
+				static_cast<GLfloat>(cacheRenderHeight) / staticDepthHeight));
+			glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+			glViewport(0, 0, shadowRenderWidth, shadowRenderHeight);
+			glDepthFunc(GL_ALWAYS);
+			for (int cascade = 0; cascade < CASCADE_COUNT; cascade++)
+			{
+				glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0, cascade);
+				shadowCacheShader.SetInt("layer", cascade);
+				shadowCacheShader.SetMat4("cascadeToCache", staticShadowWindows[cascade] * glm::inverse(cascadeViewProjections[cascade]));
+				shadowCacheShader.SetMat4("cacheToCascade", cascadeViewProjections[cascade] * glm::inverse(staticShadowWindows[cascade]));
+				glDrawArrays(GL_TRIANGLES, 0, 3);
+				CountProfileDraw(profiler, 1);
+			}
+			glDepthFunc(GL_LESS);
+			glBindSampler(0, 0);
+
+			activeDepthShader.Use(glState);
+			BindVertexArray(glState, instancedShaders ? depthInstancedVao : depthVao);
+			drawShadowCasters(ShadowCasters::Dynamic, layeredFbo, depthTexture, false);
+		}
+		else
+		{
+			activeDepthShader.Use(glState);
+			glViewport(0, 0, shadowRenderWidth, shadowRenderHeight);
+			drawShadowCasters(ShadowCasters::All, layeredFbo, depthTexture, true);
+		}
+		EndProfileSection(profiler, PROFILE_SHADOW_PASS);
+
+
+		// LOCAL LIGHT SHADOWS
+		// every due view clears and renders only its own atlas tile, with the first pass's VAO still bound
+		if (activeLocalShadowShader != nullptr)
+		{
+			BeginProfileSection(profiler, PROFILE_LOCAL_SHADOW_PASS);
+			activeLocalShadowShader->Use(glState);
+			glBindFramebuffer(GL_FRAMEBUFFER, shadowAtlasFbo);
+			glEnable(GL_SCISSOR_TEST);
+			for (size_t i = 0; i < shadowViews.size(); i++)
+			{
+				if (!renderedShadowViews[i])
+				{
+					continue;
+				}
+				const ShadowView& view = shadowViews[i];
+				glViewport(view.x, view.y, view.size, view.size);
+				glScissor(view.x, view.y, view.size, view.size);
+				glClear(GL_DEPTH_BUFFER_BIT);
+				activeLocalShadowShader->SetMat4("shadowViewProjection", view.viewProjection);
+				drawScene(*activeLocalShadowShader, ShadowCasters::All, CULL_VIEW_COUNT + static_cast<int>(i));
+			}
+			glDisable(GL_SCISSOR_TEST);
+			EndProfileSection(profiler, PROFILE_LOCAL_SHADOW_PASS);
+		}
+
+
+		// MOMENT SHADOWS
+		// warp and blur horizontally into the scratch layer, blur that vertically into the cascade's layer, then mipmap
+		if (momentShadows)
+		{
+			BeginProfileSection(profiler, PROFILE_MOMENTS_PASS);
+			ShaderProgram& horizontalBlurShader = momentsBlurShaderPermutation(true);
+			ShaderProgram& verticalBlurShader = momentsBlurShaderPermutation(false);
+			BindVertexArray(glState, fullscreenVao);
+			glBindFramebuffer(GL_FRAMEBUFFER, momentsFbo);
+			// the blur reads only the rendered part of each cascade and repeats its edge into a guard band,
+			// so the mips next to the edge don't average in the stale rest of the layer
+			GLuint momentsWidth = std::min(depthTextureWidth, shadowRenderWidth + MOMENTS_GUARD_TEXELS);
+			GLuint momentsHeight = std::min(depthTextureHeight, shadowRenderHeight + MOMENTS_GUARD_TEXELS);
+			glm::vec2 momentsSourceSize(shadowRenderWidth, shadowRenderHeight);
+			glViewport(0, 0, momentsWidth, momentsHeight);
+			glDisable(GL_DEPTH_TEST);
+			glBindSampler(0, depthReadSampler);
+			for (int cascade = 0; cascade < CASCADE_COUNT; cascade++)
+			{
+				horizontalBlurShader.Use(glState);
+				BindTexture(glState, 0, GL_TEXTURE_2D_ARRAY, depthTexture);
+				horizontalBlurShader.SetInt("blurSource", 0);
+				horizontalBlurShader.SetInt("layer", cascade);
+				horizontalBlurShader.SetVec2("sourceSize", momentsSourceSize);
+				glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, momentsBlurTexture, 0, 0);
+				glDrawArrays(GL_TRIANGLES, 0, 3);
+				CountProfileDraw(profiler, 1);
+
+				verticalBlurShader.Use(glState);
+				BindTexture(glState, 0, GL_TEXTURE_2D_ARRAY, momentsBlurTexture);
+				verticalBlurShader.SetInt("blurSource", 0);
+				verticalBlurShader.SetInt("layer", 0);
+				verticalBlurShader.SetVec2("sourceSize", momentsSourceSize);
+				glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, momentsTexture, 0, cascade);
+				glDrawArrays(GL_TRIANGLES, 0, 3);
+				CountProfileDraw(profiler, 1);
+			}
+			glBindSampler(0, 0);
+			glEnable(GL_DEPTH_TEST);
+			BindTexture(glState, 2, GL_TEXTURE_2D_ARRAY, momentsTexture);
+			glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+			EndProfileSection(profiler, PROFILE_MOMENTS_PASS);
+		}
+
+
+		// SECOND PASS
+		BeginProfileSection(profiler, PROFILE_MAIN_PASS);
+		glBindFramebuffer(GL_FRAMEBUFFER, sceneFbo);
+		glViewport(0, 0, windowWidth, windowHeight);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		// DEPTH PRE-PASS
+		// positions only into the window's depth, then the lighting below passes only where it matches exactly
+		if (depthPrePass)
+		{
+			ShaderProgram& activeCameraDepthShader = cameraDepthShaderPermutation(instancedShaders);
+			activeCameraDepthShader.Use(glState);
+			BindVertexArray(glState, instancedShaders ? depthInstancedVao : depthVao);
+			glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+			drawScene(activeCameraDepthShader, ShadowCasters::All, CAMERA_VIEW);
+			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			glDepthFunc(GL_EQUAL);
+			glDepthMask(GL_FALSE);
+		}
+
+		activeMainShader.Use(glState);
+		BindVertexArray(glState, instancedShaders ? instancedVao : vao);
+
+		BindTexture(glState, 0, GL_TEXTURE_2D_ARRAY, depthTexture);
+		activeMainShader.SetInt("shadowMap", 0);
+		if (clusteredLightingSupported)
+		{
+			BindTexture(glState, 1, GL_TEXTURE_2D, shadowAtlas);
+			activeMainShader.SetInt("shadowAtlas", 1);
+		}
+		if (momentShadows)
+		{
+			BindTexture(glState, 2, GL_TEXTURE_2D_ARRAY, momentsTexture);
+			activeMainShader.SetInt("shadowMoments", 2);
+		}
+		BindTexture(glState, MATERIAL_TEXTURE_UNIT, GL_TEXTURE_2D_ARRAY, textureLoader.texture);
+		activeMainShader.SetInt("materialTextures", MATERIAL_TEXTURE_UNIT);
+		
+		// DRAW AGAIN 😎
+		drawScene(activeMainShader, ShadowCasters::All, CAMERA_VIEW);
+		if (depthPrePass)
+		{
+			glDepthFunc(GL_LESS);
+			glDepthMask(GL_TRUE);
+		}
+		EndProfileSection(profiler, PROFILE_MAIN_PASS);
+		EndStreamFrame(instanceStream);
+		EndStreamFrame(uniformStream);
+		if (lightStream.buffer != 0)
+		{
+			EndStreamFrame(lightStream);
+		}
+		EndProfileSection(profiler, PROFILE_FRAME);
+
+		// the summary lags PROFILER_QUERY_FRAMES behind, which doesn't matter over a rolling window
+		if (currentTime - lastProfileTitleTime >= profileTitleInterval)
+		{
+			lastProfileTitleTime = currentTime;
+			std::string summary = FormatProfileSummary(profiler);
+			std::string title = summary.empty() ? "Shadow Mapping 👻" : "Shadow Mapping 👻 | " + summary;
+			if (shadowQualityController.enabled)
+			{
+				title += " | shadows " + std::to_string(static_cast<int>(shadowQuality.resolutionScale * 100.0f + 0.5f))
+					+ "% refresh x" + std::to_string(shadowQuality.refreshScale);
+			}
+			if (profiler.csv.is_open())
+			{
+				title += " | recording";
+			}
+			glfwSetWindowTitle(window, title.c_str());
+		}
+
+
+		glfwSwapBuffers(window);
+
+		glfwPollEvents();
+
+		if (frameInterval > std::chrono::steady_clock::duration::zero())
+		{
+			WaitForFrameDeadline(frameDeadline, frameInterval);
+		}
+
+		if (benchmark.enabled)
+		{
+			if (benchmarkMeasuring)
+			{
+				std::chrono::duration<GLfloat, std::milli> frameTime = std::chrono::steady_clock::now() - frameStart;
+				benchmarkConfigurations[benchmarkConfiguration].cpuMilliseconds.push_back(frameTime.count());
+			}
+			// GPU times arrive a few frames late, possibly during the next configuration's warm-up
+			const std::deque<ProfileSample>& frameHistory = profiler.history[PROFILE_FRAME];
+			if (!frameHistory.empty() && frameHistory.back().frame > lastBenchmarkGpuFrame)
+			{
+				lastBenchmarkGpuFrame = frameHistory.back().frame;
+				int sampleFrame = static_cast<int>(lastBenchmarkGpuFrame - 1);
+				int sampleConfiguration = sampleFrame / framesPerConfiguration;
+				if (sampleConfiguration < static_cast<int>(benchmarkConfigurations.size())
+					&& sampleFrame - sampleConfiguration * framesPerConfiguration >= BENCHMARK_WARMUP_FRAMES)
+				{
+					benchmarkConfigurations[sampleConfiguration].gpuMilliseconds.push_back(frameHistory.back().gpuMilliseconds);
+				}
+			}
+		}
+	}
+
+	if (benchmark.enabled)
+	{
+		WriteBenchmarkResults(BENCHMARK_CSV_FILE, benchmarkConfigurations, benchmark, pcfKernelTaps, scene.objects.size());
+		glDeleteFramebuffers(1, &sceneFbo);
+		glDeleteRenderbuffers(1, &sceneColorRenderbuffer);
+		glDeleteRenderbuffers(1, &sceneDepthRenderbuffer);
+	}
+
+	StopJobSystem(jobs);
+	StopTextureLoader(glState, textureLoader);
+	DeleteShaderPermutations(shaderCache);
+	DeleteFrameProfiler(profiler);
+
+	glDeleteBuffers(1, &vbo);
+	glDeleteBuffers(1, &attributeVbo);
+	glDeleteBuffers(1, &ebo);
+	DeleteStreamBuffer(glState, instanceStream);
+	DeleteStreamBuffer(glState, uniformStream);
+	DeleteStreamBuffer(glState, lightStream);
+	if (clusteredLightingSupported)
+	{
+		glDeleteProgram(clusterProgram.id);
+		glDeleteBuffers(1, &localLightBuffer);
+		glDeleteBuffers(1, &shadowViewBuffer);
+		glDeleteBuffers(1, &clusterLightBuffer);
+		glDeleteFramebuffers(1, &shadowAtlasFbo);
+		glDeleteTextures(1, &shadowAtlas);
+	}
+	if (gpuDrivenSupported)
+	{
+		glDeleteProgram(cullProgram.id);
+		glDeleteBuffers(1, &gpuInstanceBuffer);
+		glDeleteBuffers(1, &gpuBoundsBuffer);
+		glDeleteBuffers(1, &commandTemplateBuffer);
+		glDeleteBuffers(1, &commandBuffer);
+		glDeleteBuffers(1, &gpuCulledInstanceVbo);
+	}
+	glDeleteVertexArrays(1, &vao);
+	glDeleteVertexArrays(1, &instancedVao);
+	glDeleteVertexArrays(1, &depthVao);
+	glDeleteVertexArrays(1, &depthInstancedVao);
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteFramebuffers(1, &layeredFbo);
+	glDeleteFramebuffers(1, &staticCacheFbo);
+	glDeleteFramebuffers(1, &momentsFbo);
+	glDeleteTextures(1, &momentsTexture);
+	glDeleteTextures(1, &momentsBlurTexture);
+	glDeleteSamplers(1, &depthReadSampler);
+	glDeleteVertexArrays(1, &fullscreenVao);
+	glDeleteTextures(1, &depthTexture);
+	glDeleteTextures(1, &staticDepthTexture);
+
+	glfwTerminate();
+
+	return 0;
+}
+
+// shader stage and the file it is read from
+typedef std::vector<std::pair<GLenum, std::string>> ShaderStages;
+
+static void SubmitShaderStages(ShaderProgram& program, const ShaderStages& stages, const ShaderDefines& defines)
+{
+	program = ShaderProgram();
+
+	// read every stage first, the sources are part of the binary cache key
+	std::vector<std::string> sources(stages.size());
+	bool sourcesRead = true;
+	for (size_t i = 0; i < stages.size(); i++)
+	{
+		sourcesRead = ReadShaderFile(stages[i].second, sources[i]) && sourcesRead;
+		sources[i] = InsertShaderDefines(sources[i], defines);
+	}
+
+	std::string cachePath;
+	if (sourcesRead && ProgramBinariesSupported())
+	{
+		cachePath = ProgramBinaryCachePath(sources);
+		GLuint cachedProgram = LoadProgramBinary(cachePath);
+		if (cachedProgram != 0)
+		{
+			// nothing left to compile, finishing only caches the uniforms
+			program.id = cachedProgram;
+			return;
+		}
+	}
+
+	// none of these wait for the driver, errors are collected in FinishShaderProgram
+	for (size_t i = 0; i < stages.size(); i++)
+	{
+		program.pendingShaders.push_back(SubmitShaderSource(stages[i].first, sources[i]));
+	}
+
+	program.id = glCreateProgram();
+	if (!cachePath.empty())
+	{
+		glProgramParameteri(program.id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		program.binaryCachePath = cachePath;
+	}
+	for (GLuint shader : program.pendingShaders)
+	{
+		glAttachShader(program.id, shader);
+	}
+
+	glLinkProgram(program.id);
+}
+
+void SubmitShaderProgram(ShaderProgram& program, const std::string& vertexShaderFilePath, const std::string& fragmentShaderFilePath,
+	const std::string& geometryShaderFilePath, const ShaderDefines& defines)
+{
+	ShaderStages stages = { { GL_VERTEX_SHADER, vertexShaderFilePath } };
+	if (!geometryShaderFilePath.empty())
+	{
+		stages.push_back({ GL_GEOMETRY_SHADER, geometryShaderFilePath });
+	}
+	stages.push_back({ GL_FRAGMENT_SHADER, fragmentShaderFilePath });
+	SubmitShaderStages(program, stages, defines);
+}
+
+void SubmitComputeProgram(ShaderProgram& program, const std::string& computeShaderFilePath, const ShaderDefines& defines)
+{
+	SubmitShaderStages(program, { { GL_COMPUTE_SHADER, computeShaderFilePath } }, defines);
+}
+
+bool IsShaderProgramBuildComplete(const ShaderProgram& program)
+{
+	if (program.ready || program.pendingShaders.empty())
+	{
+		return true;
+	}
+	// without the extension any status query would block, so wait for the first use instead
+	if (!parallelShaderCompileSupported)
+	{
+		return false;
+	}
+
+	GLint completionStatus = GL_FALSE;
+	glGetProgramiv(program.id, GL_COMPLETION_STATUS_KHR, &completionStatus);
+	return completionStatus == GL_TRUE;
+}
+
+void FinishShaderProgram(ShaderProgram& program)
+{
+	if (program.ready)
+	{
+		return;
+	}
+
+	for (GLuint shader : program.pendingShaders)
+	{
+		CheckShaderCompileStatus(shader);
+	}
+
+	// Check shader program link status
+	GLint linkStatus;
+	glGetProgramiv(program.id, GL_LINK_STATUS, &linkStatus);
+	if (linkStatus != GL_TRUE) {
+		char infoLog[512];
+		GLsizei infoLogLen = sizeof(infoLog);
+		glGetProgramInfoLog(program.id, infoLogLen, &infoLogLen, infoLog);
+		std::cerr << "program link error: " << infoLog << std::endl;
+	}
+	else if (!program.binaryCachePath.empty())
+	{
+		SaveProgramBinary(program.id, program.binaryCachePath);
+	}
+
+	for (GLuint shader : program.pendingShaders)
+	{
+		glDetachShader(program.id, shader);
+		glDeleteShader(shader);
+	}
+	program.pendingShaders.clear();
+
+	CacheActiveUniforms(program);
+	program.ready = true;
+}
+
+void InitParallelShaderCompile()
+{
+	// loaded by hand so this works whether or not the GLAD build includes the extension
+	typedef void (APIENTRY* MaxShaderCompilerThreadsProc)(GLuint count);
+	const char* extensions[] = { "GL_KHR_parallel_shader_compile", "GL_ARB_parallel_shader_compile" };
+	const char* entryPoints[] = { "glMaxShaderCompilerThreadsKHR", "glMaxShaderCompilerThreadsARB" };
+	for (int i = 0; i < 2; i++)
+	{
+		if (glfwExtensionSupported(extensions[i]))
+		{
+			MaxShaderCompilerThreadsProc maxShaderCompilerThreads =
+				reinterpret_cast<MaxShaderCompilerThreadsProc>(glfwGetProcAddress(entryPoints[i]));
+			if (maxShaderCompilerThreads != nullptr)
+			{
+				// let the driver use as many threads as it wants
+				maxShaderCompilerThreads(0xFFFFFFFF);
+			}
+			parallelShaderCompileSupported = true;
+			return;
+		}
+	}
+}
+
+bool ProgramBinariesSupported()
+{
+	if (!GLAD_GL_VERSION_4_1 && !GLAD_GL_ARB_get_program_binary)
+	{
+		return false;
+	}
+
+	// some drivers expose the entry points but no formats
+	GLint formatCount = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+	return formatCount > 0;
+}
+
+std::string ProgramBinaryCachePath(const std::vector<std::string>& shaderSources)
+{
+	// binaries are only valid for the driver that produced them
+	uint64_t hash = HashString(reinterpret_cast<const char*>(glGetString(GL_VENDOR)));
+	hash = HashString(reinterpret_cast<const char*>(glGetString(GL_RENDERER)), hash);
+	hash = HashString(reinterpret_cast<const char*>(glGetString(GL_VERSION)), hash);
+	for (const std::string& source : shaderSources)
+	{
+		// the separator keeps moving text between stages from producing the same hash
+		hash = HashString(source + '\0', hash);
+	}
+
+	std::ostringstream path;
+	path << PROGRAM_BINARY_CACHE_DIRECTORY << "/" << std::hex << hash << ".bin";
+	return path.str();
+}
+
+GLuint LoadProgramBinary(const std::string& cachePath)
+{
+	std::ifstream cacheFile(cachePath, std::ios::binary);
+	if (cacheFile.fail())
+	{
+		return 0;
+	}
+
+	// the file is the binary format followed by the binary itself
+	GLenum binaryFormat;
+	if (!cacheFile.read(reinterpret_cast<char*>(&binaryFormat), sizeof(binaryFormat)))
+	{
+		return 0;
+	}
+	std::vector<char> binary((std::istreambuf_iterator<char>(cacheFile)), std::istreambuf_iterator<char>());
+	if (binary.empty())
+	{
+		return 0;
+	}
+
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, binaryFormat, binary.data(), static_cast<GLsizei>(binary.size()));
+
+	// a driver update can reject old binaries, in which case the caller recompiles and overwrites the entry
+	GLint linkStatus;
+	glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
+	if (linkStatus != GL_TRUE)
+	{
+		glDeleteProgram(program);
+		return 0;
+	}
+
+	return program;
+}
+
+void SaveProgramBinary(GLuint program, const std::string& cachePath)
+{
+	GLint binaryLength = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &binaryLength);
+	if (binaryLength <= 0)
+	{
+		return;
+	}
+
+	std::vector<char> binary(binaryLength);
+	GLenum binaryFormat;
+	glGetProgramBinary(program, binaryLength, nullptr, &binaryFormat, binary.data());
+
+	std::error_code error;
+	std::filesystem::create_directories(PROGRAM_BINARY_CACHE_DIRECTORY, error);
+
+	std::ofstream cacheFile(cachePath, std::ios::binary);
+	if (cacheFile.fail())
+	{
+		std::cerr << "Unable to write program binary cache: " << cachePath << std::endl;
+		return;
+	}
+	cacheFile.write(reinterpret_cast<const char*>(&binaryFormat), sizeof(binaryFormat));
+	cacheFile.write(binary.data(), binary.size());
+}
+
+uint64_t HashString(const std::string& value, uint64_t hash)
+{
+	// 64-bit FNV-1a
+	for (unsigned char c : value)
+	{
+		hash ^= c;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+void CacheActiveUniforms(ShaderProgram& program)
+{
+	program.uniforms.clear();
+
+	GLint uniformCount = 0;
+	GLint maxNameLength = 0;
+	glGetProgramiv(program.id, GL_ACTIVE_UNIFORMS, &uniformCount);
+	glGetProgramiv(program.id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+	std::vector<char> nameBuffer(maxNameLength + 1);
+	for (GLint i = 0; i < uniformCount; i++)
+	{
+		GLsizei nameLength = 0;
+		GLint size = 0;
+		GLenum type = 0;
+		glGetActiveUniform(program.id, i, static_cast<GLsizei>(nameBuffer.size()), &nameLength, &size, &type, nameBuffer.data());
+
+		std::string name(nameBuffer.data(), nameLength);
+		GLint location = glGetUniformLocation(program.id, name.c_str());
+		// uniforms inside blocks have no location
+		if (location == -1)
+		{
+			continue;
+		}
+
+		// arrays are reported as "name[0]", store them under the plain name
+		if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+		{
+			name.erase(name.size() - 3);
+		}
+
+		program.uniforms.push_back({ name, location, type, size, {} });
+	}
+
+	program.objectUniforms.model = program.FindUniform("model");
+	program.objectUniforms.normalMatrix = program.FindUniform("normalMatrix");
+	program.objectUniforms.material = program.FindUniform("material");
+	program.objectUniforms.textureLayer = program.FindUniform("textureLayer");
+}
+
+ShaderProgram& GetShaderPermutation(ShaderPermutationCache& cache, const std::string& vertexShaderFilePath,
+	const std::string& fragmentShaderFilePath, const std::string& geometryShaderFilePath, ShaderDefines defines)
+{
+	defines.insert(defines.end(), cache.globalDefines.begin(), cache.globalDefines.end());
+	// sorted so the same set of defines always maps to the same key
+	std::sort(defines.begin(), defines.end());
+
+	std::string key = vertexShaderFilePath + "|" + geometryShaderFilePath + "|" + fragmentShaderFilePath;
+	for (const std::string& define : defines)
+	{
+		key += "|" + define;
+	}
+
+	auto it = cache.programs.find(key);
+	if (it != cache.programs.end())
+	{
+		return it->second;
+	}
+
+	ShaderProgram& program = cache.programs[key];
+	SubmitShaderProgram(program, vertexShaderFilePath, fragmentShaderFilePath, geometryShaderFilePath, defines);
+	return program;
+}
+
+void PollShaderPermutations(ShaderPermutationCache& cache)
+{
+	for (auto& entry : cache.programs)
+	{
+		if (!entry.second.ready && IsShaderProgramBuildComplete(entry.second))
+		{
+			FinishShaderProgram(entry.second);
+		}
+	}
+}
+
+void DeleteShaderPermutations(ShaderPermutationCache& cache)
+{
+	for (auto& entry : cache.programs)
+	{
+		glDeleteProgram(entry.second.id);
+	}
+	cache.programs.clear();
+}
+
+void ShaderProgram::Use(GlStateCache& state)
+{
+	FinishShaderProgram(*this);
+	UseProgram(state, id);
+}
+
+UniformHandle ShaderProgram::FindUniform(const char* name) const
+{
+	for (size_t i = 0; i < uniforms.size(); i++)
+	{
+		if (uniforms[i].name == name)
+		{
+			return static_cast<UniformHandle>(i);
+		}
+	}
+	return NO_UNIFORM;
+}
+
+ShaderProgram::Uniform* ShaderProgram::FindChangedUniform(UniformHandle handle, const void* value, size_t valueSize)
+{
+	// returns nullptr for inactive uniforms (same as glUniform* with location -1) and for unchanged values
+	if (handle == NO_UNIFORM)
+	{
+		return nullptr;
+	}
+
+	Uniform& uniform = uniforms[handle];
+	if (uniform.lastValue.size() == valueSize && std::memcmp(uniform.lastValue.data(), value, valueSize) == 0)
+	{
+		return nullptr;
+	}
+
+	const unsigned char* bytes = static_cast<const unsigned char*>(value);
+	uniform.lastValue.assign(bytes, bytes + valueSize);
+	return &uniform;
+}
+
+void ShaderProgram::SetInt(const char* name, GLint value)
+{
+	SetInt(FindUniform(name), value);
+}
+
+void ShaderProgram::SetFloat(const char* name, GLfloat value)
+{
+	SetFloat(FindUniform(name), value);
+}
+
+void ShaderProgram::SetVec2(const char* name, const glm::vec2& value)
+{
+	SetVec2(FindUniform(name), value);
+}
+
+void ShaderProgram::SetVec4(const char* name, const glm::vec4& value)
+{
+	SetVec4(FindUniform(name), value);
+}
+
+void ShaderProgram::SetMat3(const char* name, const glm::mat3& value)
+{
+	SetMat3(FindUniform(name), value);
+}
+
+void ShaderProgram::SetMat4(const char* name, const glm::mat4& value)
+{
+	SetMat4(FindUniform(name), value);
+}
+
+void ShaderProgram::SetInt(UniformHandle handle, GLint value)
+{
+	if (Uniform* uniform = FindChangedUniform(handle, &value, sizeof(value)))
+	{
+		glUniform1i(uniform->location, value);
+	}
+}
+
+void ShaderProgram::SetFloat(UniformHandle handle, GLfloat value)
+{
+	if (Uniform* uniform = FindChangedUniform(handle, &value, sizeof(value)))
+	{
+		glUniform1f(uniform->location, value);
+	}
+}
+
+void ShaderProgram::SetVec2(UniformHandle handle, const glm::vec2& value)
+{
+	if (Uniform* uniform = FindChangedUniform(handle, glm::value_ptr(value), sizeof(value)))
+	{
+		glUniform2fv(uniform->location, 1, glm::value_ptr(value));
+	}
+}
+
+void ShaderProgram::SetVec4(UniformHandle handle, const glm::vec4& value)
+{
+	if (Uniform* uniform = FindChangedUniform(handle, glm::value_ptr(value), sizeof(value)))
+	{
+		glUniform4fv(uniform->location, 1, glm::value_ptr(value));
+	}
+}
+
+void ShaderProgram::SetMat3(UniformHandle handle, const glm::mat3& value)
+{
+	if (Uniform* uniform = FindChangedUniform(handle, glm::value_ptr(value), sizeof(value)))
+	{
+		glUniformMatrix3fv(uniform->location, 1, GL_FALSE, glm::value_ptr(value));
+	}
+}
+
+void ShaderProgram::SetMat4(UniformHandle handle, const glm::mat4& value)
+{
+	if (Uniform* uniform = FindChangedUniform(handle, glm::value_ptr(value), sizeof(value)))
+	{
+		glUniformMatrix4fv(uniform->location, 1, GL_FALSE, glm::value_ptr(value));
+	}
+}
+
+GLuint CreateShaderFromFile(const GLuint& shaderType, const std::string& shaderFilePath, const ShaderDefines& defines)
+{
+	std::string shaderSource;
+	if (!ReadShaderFile(shaderFilePath, shaderSource))
+	{
+		return 0;
+	}
+
+	return CreateShaderFromSource(shaderType, InsertShaderDefines(shaderSource, defines));
+}
+
+bool ReadShaderFile(const std::string& shaderFilePath, std::string& shaderSource)
+{
+	std::ifstream shaderFile(shaderFilePath);
+	if (shaderFile.fail())
+	{
+		std::cerr << "Unable to open shader file: " << shaderFilePath << std::endl;
+		return false;
+	}
+
+	shaderSource.clear();
+	std::string temp;
+	while (std::getline(shaderFile, temp))
+	{
+		shaderSource += temp + "\n";
+	}
+	shaderFile.close();
+
+	return true;
+}
+
+std::string InsertShaderDefines(const std::string& shaderSource, const ShaderDefines& defines)
+{
+	if (defines.empty())
+	{
+		return shaderSource;
+	}
+
+	// #version has to stay the first statement, so the defines go right after its line
+	size_t versionStart = shaderSource.find("#version");
+	size_t insertAt = 0;
+	int versionLine = 0;
+	if (versionStart != std::string::npos)
+	{
+		size_t versionEnd = shaderSource.find('\n', versionStart);
+		insertAt = versionEnd == std::string::npos ? shaderSource.size() : versionEnd + 1;
+		versionLine = 1 + static_cast<int>(std::count(shaderSource.begin(), shaderSource.begin() + versionStart, '\n'));
+	}
+
+	std::string defineBlock;
+	for (const std::string& define : defines)
+	{
+		defineBlock += "#define " + define + "\n";
+	}
+	// keep compiler error line numbers pointing at the original file
+	defineBlock += "#line " + std::to_string(versionLine + 1) + "\n";
+
+	std::string result = shaderSource;
+	result.insert(insertAt, defineBlock);
+	return result;
+}
+
+GLuint CreateShaderFromSource(const GLuint& shaderType, const std::string& shaderSource)
+{
+	GLuint shader = SubmitShaderSource(shaderType, shaderSource);
+	CheckShaderCompileStatus(shader);
+	return shader;
+}
+
+GLuint SubmitShaderSource(const GLuint& shaderType, const std::string& shaderSource)
+{
+	GLuint shader = glCreateShader(shaderType);
+
+	const char* shaderSourceCStr = shaderSource.c_str();
+	GLint shaderSourceLen = static_cast<GLint>(shaderSource.length());
+	glShaderSource(shader, 1, &shaderSourceCStr, &shaderSourceLen);
+	glCompileShader(shader);
+
+	return shader;
+}
+
+bool CheckShaderCompileStatus(GLuint shader)
+{
+	// Check compilation status
+	GLint compileStatus;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compileStatus);
+	if (compileStatus == GL_FALSE)
+	{
+		char infoLog[512];
+		GLsizei infoLogLen = sizeof(infoLog);
+		glGetShaderInfoLog(shader, infoLogLen, &infoLogLen, infoLog);
+		std::cerr << "shader compilation error: " << infoLog << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+void ComputeShadowCascades(const glm::mat4& viewMatrix, GLfloat fieldOfView, GLfloat aspectRatio, GLfloat nearPlane,
+	const glm::vec3& lightDirection, GLuint shadowMapResolution, glm::mat4* lightViewProjections, GLfloat* cascadeSplits)
+{
+	glm::mat4 inverseView = glm::inverse(viewMatrix);
+	GLfloat tanHalfFovY = tan(fieldOfView / 2.0f);
+	GLfloat tanHalfFovX = tanHalfFovY * aspectRatio;
+	glm::vec3 lightDir = glm::normalize(lightDirection);
+	// any up vector works as long as it isn't parallel to the light
+	glm::vec3 lightUp = std::abs(lightDir.y) > 0.99f ? glm::vec3(0, 0, 1) : glm::vec3(0, 1, 0);
+
+	GLfloat cascadeNear = nearPlane;
+	for (int i = 0; i < CASCADE_COUNT; i++)
+	{
+		// practical split scheme, a blend of logarithmic and uniform splits
+		GLfloat t = (i + 1) / (GLfloat)CASCADE_COUNT;
+		GLfloat logSplit = nearPlane * pow(SHADOW_DISTANCE / nearPlane, t);
+		GLfloat uniformSplit = nearPlane + (SHADOW_DISTANCE - nearPlane) * t;
+		GLfloat cascadeFar = CASCADE_SPLIT_LAMBDA * logSplit + (1.0f - CASCADE_SPLIT_LAMBDA) * uniformSplit;
+		cascadeSplits[i] = cascadeFar;
+
+		// world-space corners of this slice of the camera frustum
+		glm::vec3 corners[8];
+		GLfloat sliceDepths[2] = { cascadeNear, cascadeFar };
+		for (int j = 0; j < 2; j++)
+		{
+			GLfloat x = sliceDepths[j] * tanHalfFovX;
+			GLfloat y = sliceDepths[j] * tanHalfFovY;
+			GLfloat z = -sliceDepths[j];
+			corners[j * 4 + 0] = glm::vec3(inverseView * glm::vec4(-x, -y, z, 1.0f));
+			corners[j * 4 + 1] = glm::vec3(inverseView * glm::vec4(x, -y, z, 1.0f));
+			corners[j * 4 + 2] = glm::vec3(inverseView * glm::vec4(x, y, z, 1.0f));
+			corners[j * 4 + 3] = glm::vec3(inverseView * glm::vec4(-x, y, z, 1.0f));
+		}
+
+		// a bounding sphere keeps the projection size constant as the camera rotates, so shadows don't shimmer
+		glm::vec3 center(0.0f);
+		for (int j = 0; j < 8; j++)
+		{
+			center += corners[j];
+		}
+		center /= 8.0f;
+		GLfloat radius = 0.0f;
+		for (int j = 0; j < 8; j++)
+		{
+			radius = glm::max(radius, glm::length(corners[j] - center));
+		}
+		radius = ceil(radius * 16.0f) / 16.0f;
+
+		glm::mat4 lightView = glm::lookAt(center - lightDir * (radius + SHADOW_CASTER_MARGIN), center, lightUp);
+		glm::mat4 lightProjection = glm::ortho(-radius, radius, -radius, radius, 0.0f, 2.0f * radius + SHADOW_CASTER_MARGIN);
+
+		// snap the projection to whole texels so edges don't crawl when the camera moves
+		glm::mat4 lightViewProjection = lightProjection * lightView;
+		GLfloat halfResolution = shadowMapResolution / 2.0f;
+		glm::vec4 origin = lightViewProjection * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+		GLfloat offsetX = (round(origin.x * halfResolution) - origin.x * halfResolution) / halfResolution;
+		GLfloat offsetY = (round(origin.y * halfResolution) - origin.y * halfResolution) / halfResolution;
+		lightProjection[3][0] += offsetX;
+		lightProjection[3][1] += offsetY;
+
+		lightViewProjections[i] = lightProjection * lightView;
+		cascadeNear = cascadeFar;
+	}
+}
+
+void BindInstanceAttributes(GLuint firstInstance)
+{
+	// Points the instance attributes of the bound VAO at the given instance in the bound GL_ARRAY_BUFFER.
+	// This stands in for glDrawElementsInstancedBaseInstance, which needs GL 4.2.
+	GLintptr offset = firstInstance * sizeof(InstanceData);
+	for (GLuint i = 0; i < 4; i++)
+	{
+		glVertexAttribPointer(INSTANCE_ATTRIBUTE_LOCATION + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+			(void*)(offset + offsetof(InstanceData, model) + i * sizeof(glm::vec4)));
+	}
+	// only xyz of each padded column is read
+	for (GLuint i = 0; i < 3; i++)
+	{
+		glVertexAttribPointer(NORMAL_MATRIX_ATTRIBUTE_LOCATION + i, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+			(void*)(offset + offsetof(InstanceData, normalMatrix) + i * sizeof(glm::vec4)));
+	}
+	glVertexAttribPointer(MATERIAL_ATTRIBUTE_LOCATION, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+		(void*)(offset + offsetof(InstanceData, material)));
+	glVertexAttribPointer(TEXTURE_LAYER_ATTRIBUTE_LOCATION, 1, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+		(void*)(offset + offsetof(InstanceData, textureParams)));
+}
+
+size_t TransformStore::Add(const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale)
+{
+	positionX.push_back(position.x);
+	positionY.push_back(position.y);
+	positionZ.push_back(position.z);
+	rotationX.push_back(rotation.x);
+	rotationY.push_back(rotation.y);
+	rotationZ.push_back(rotation.z);
+	rotationW.push_back(rotation.w);
+	scaleX.push_back(scale.x);
+	scaleY.push_back(scale.y);
+	scaleZ.push_back(scale.z);
+	dirty.push_back(1);
+	return dirty.size() - 1;
+}
+
+void TransformStore::SetPosition(size_t index, const glm::vec3& position)
+{
+	positionX[index] = position.x;
+	positionY[index] = position.y;
+	positionZ[index] = position.z;
+	dirty[index] = 1;
+}
+
+void TransformStore::SetRotation(size_t index, const glm::quat& rotation)
+{
+	rotationX[index] = rotation.x;
+	rotationY[index] = rotation.y;
+	rotationZ[index] = rotation.z;
+	rotationW[index] = rotation.w;
+	dirty[index] = 1;
+}
+
+void TransformStore::SetScale(size_t index, const glm::vec3& scale)
+{
+	scaleX[index] = scale.x;
+	scaleY[index] = scale.y;
+	scaleZ[index] = scale.z;
+	dirty[index] = 1;
+}
+
+#ifdef HAVE_SSE
+// loads lanes [first, first + count) of a component array, zero filling past the end
+static inline __m128 LoadLanes(const std::vector<float>& values, size_t first, size_t count, float fill = 0.0f)
+{
+	if (count == 4)
+	{
+		return _mm_loadu_ps(&values[first]);
+	}
+	float lanes[4] = { fill, fill, fill, fill };
+	for (size_t i = 0; i < count; i++)
+	{
+		lanes[i] = values[first + i];
+	}
+	return _mm_loadu_ps(lanes);
+}
+
+// turns 4 SoA columns (x, y, z, w of 4 objects) into one vec4 per object and stores the valid ones
+static inline void StoreColumns(__m128 x, __m128 y, __m128 z, __m128 w, glm::vec4* const* columns, size_t count)
+{
+	_MM_TRANSPOSE4_PS(x, y, z, w);
+	__m128 perObject[4] = { x, y, z, w };
+	for (size_t i = 0; i < count; i++)
+	{
+		_mm_storeu_ps(glm::value_ptr(*columns[i]), perObject[i]);
+	}
+}
+
+void UpdateWorldMatrices(TransformStore& transforms, InstanceData* instances, size_t rangeFirst, size_t rangeLast)
+{
+	size_t size = std::min(transforms.Size(), rangeLast);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 zero = _mm_setzero_ps();
+
+	for (size_t first = rangeFirst; first < size; first += 4)
+	{
+		size_t count = std::min<size_t>(4, size - first);
+		bool dirty = false;
+		for (size_t i = 0; i < count; i++)
+		{
+			dirty |= transforms.dirty[first + i] != 0;
+		}
+		// a clean group keeps the matrices already in the instance array
+		if (!dirty)
+		{
+			continue;
+		}
+
+		__m128 qx = LoadLanes(transforms.rotationX, first, count);
+		__m128 qy = LoadLanes(transforms.rotationY, first, count);
+		__m128 qz = LoadLanes(transforms.rotationZ, first, count);
+		__m128 qw = LoadLanes(transforms.rotationW, first, count, 1.0f);
+		__m128 sx = LoadLanes(transforms.scaleX, first, count, 1.0f);
+		__m128 sy = LoadLanes(transforms.scaleY, first, count, 1.0f);
+		__m128 sz = LoadLanes(transforms.scaleZ, first, count, 1.0f);
+
+		// rotation matrix from the quaternion, rij is row i of column j
+		__m128 xx = _mm_mul_ps(qx, qx), yy = _mm_mul_ps(qy, qy), zz = _mm_mul_ps(qz, qz);
+		__m128 xy = _mm_mul_ps(qx, qy), xz = _mm_mul_ps(qx, qz), yz = _mm_mul_ps(qy, qz);
+		__m128 wx = _mm_mul_ps(qw, qx), wy = _mm_mul_ps(qw, qy), wz = _mm_mul_ps(qw, qz);
+
+		__m128 r00 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz)));
+		__m128 r10 = _mm_mul_ps(two, _mm_add_ps(xy, wz));
+		__m128 r20 = _mm_mul_ps(two, _mm_sub_ps(xz, wy));
+		__m128 r01 = _mm_mul_ps(two, _mm_sub_ps(xy, wz));
+		__m128 r11 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz)));
+		__m128 r21 = _mm_mul_ps(two, _mm_add_ps(yz, wx));
+		__m128 r02 = _mm_mul_ps(two, _mm_add_ps(xz, wy));
+		__m128 r12 = _mm_mul_ps(two, _mm_sub_ps(yz, wx));
+		__m128 r22 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy)));
+
+		glm::vec4* columns[4];
+		// model = T * S * R: the scale multiplies the rows of R, the position fills the last column
+		for (int column = 0; column < 4; column++)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				columns[i] = &instances[first + i].model[column];
+			}
+			switch (column)
+			{
+			case 0: StoreColumns(_mm_mul_ps(sx, r00), _mm_mul_ps(sy, r10), _mm_mul_ps(sz, r20), zero, columns, count); break;
+			case 1: StoreColumns(_mm_mul_ps(sx, r01), _mm_mul_ps(sy, r11), _mm_mul_ps(sz, r21), zero, columns, count); break;
+			case 2: StoreColumns(_mm_mul_ps(sx, r02), _mm_mul_ps(sy, r12), _mm_mul_ps(sz, r22), zero, columns, count); break;
+			case 3: StoreColumns(LoadLanes(transforms.positionX, first, count), LoadLanes(transforms.positionY, first, count),
+				LoadLanes(transforms.positionZ, first, count), one, columns, count); break;
+			}
+		}
+
+		// inverse transpose of S * R is S^-1 * R, so the rows of R are divided by the scale instead
+		__m128 isx = _mm_div_ps(one, sx), isy = _mm_div_ps(one, sy), isz = _mm_div_ps(one, sz);
+		for (int column = 0; column < 3; column++)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				columns[i] = &instances[first + i].normalMatrix[column];
+			}
+			switch (column)
+			{
+			case 0: StoreColumns(_mm_mul_ps(isx, r00), _mm_mul_ps(isy, r10), _mm_mul_ps(isz, r20), zero, columns, count); break;
+			case 1: StoreColumns(_mm_mul_ps(isx, r01), _mm_mul_ps(isy, r11), _mm_mul_ps(isz, r21), zero, columns, count); break;
+			case 2: StoreColumns(_mm_mul_ps(isx, r02), _mm_mul_ps(isy, r12), _mm_mul_ps(isz, r22), zero, columns, count); break;
+			}
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			transforms.dirty[first + i] = 0;
+		}
+	}
+}
+#else
+void UpdateWorldMatrices(TransformStore& transforms, InstanceData* instances, size_t first, size_t last)
+{
+	for (size_t i = first; i < std::min(transforms.Size(), last); i++)
+	{
+		if (!transforms.dirty[i])
+		{
+			continue;
+		}
+		glm::mat3 rotation = glm::mat3_cast(glm::quat(transforms.rotationW[i], transforms.rotationX[i], transforms.rotationY[i], transforms.rotationZ[i]));
+		glm::vec3 scale(transforms.scaleX[i], transforms.scaleY[i], transforms.scaleZ[i]);
+		for (int column = 0; column < 3; column++)
+		{
+			instances[i].model[column] = glm::vec4(scale * rotation[column], 0.0f);
+			instances[i].normalMatrix[column] = glm::vec4(rotation[column] / scale, 0.0f);
+		}
+		instances[i].model[3] = glm::vec4(transforms.positionX[i], transforms.positionY[i], transforms.positionZ[i], 1.0f);
+		transforms.dirty[i] = 0;
+	}
+}
+#endif
+
+glm::mat3 NormalMatrixOf(const InstanceData& instance)
+{
+	return glm::mat3(glm::vec3(instance.normalMatrix[0]), glm::vec3(instance.normalMatrix[1]), glm::vec3(instance.normalMatrix[2]));
+}
+
+bool LoadScene(const std::string& path, Scene& scene)
+{
+	std::ifstream file(path);
+	if (!file)
+	{
+		std::cerr << "Failed to open scene file " << path << std::endl;
+		return false;
+	}
+
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(file, line))
+	{
+		lineNumber++;
+		std::istringstream words(line.substr(0, line.find('#')));
+		std::string keyword;
+		if (!(words >> keyword))
+		{
+			continue;
+		}
+
+		bool valid = true;
+		if (keyword == "mesh")
+		{
+			SceneMesh mesh;
+			valid = static_cast<bool>(words >> mesh.name >> mesh.path);
+			scene.meshes.push_back(mesh);
+		}
+		else if (keyword == "material")
+		{
+			Material material;
+			valid = static_cast<bool>(words >> material.name >> material.color.x >> material.color.y >> material.color.z >> material.shininess);
+			material.textureLayer = 0;
+			std::string option;
+			if (valid && (words >> option))
+			{
+				valid = option == "texture" && (words >> material.texture);
+			}
+			if (valid && !material.texture.empty())
+			{
+				// layers are handed out in order of first use, 0 stays white
+				GLuint layerCount = 1;
+				for (const Material& other : scene.materials)
+				{
+					layerCount = std::max(layerCount, other.textureLayer + 1);
+					if (other.texture == material.texture)
+					{
+						material.textureLayer = other.textureLayer;
+					}
+				}
+				if (material.textureLayer == 0)
+				{
+					material.textureLayer = layerCount;
+				}
+			}
+			scene.materials.push_back(material);
+		}
+		else if (keyword == "pointlight" || keyword == "spotlight")
+		{
+			SceneLight light;
+			light.type = keyword == "spotlight" ? LIGHT_SPOT : LIGHT_POINT;
+			light.direction = glm::vec3(0.0f, -1.0f, 0.0f);
+			GLfloat innerDegrees = 0.0f, outerDegrees = 0.0f;
+			valid = static_cast<bool>(words >> light.position.x >> light.position.y >> light.position.z);
+			if (light.type == LIGHT_SPOT)
+			{
+				valid = valid && (words >> light.direction.x >> light.direction.y >> light.direction.z);
+			}
+			valid = valid && (words >> light.color.x >> light.color.y >> light.color.z >> light.range);
+			if (light.type == LIGHT_SPOT)
+			{
+				valid = valid && (words >> innerDegrees >> outerDegrees);
+			}
+			// the range divides the attenuation and is the far plane of the light's shadow views
+			valid = valid && light.range > LOCAL_SHADOW_NEAR_PLANE;
+			// the spot's shadow tile is a perspective view of its cone, which has to stay narrower than a half space
+			if (light.type == LIGHT_SPOT)
+			{
+				valid = valid && glm::length(light.direction) > 0.0f
+					&& innerDegrees >= 0.0f && innerDegrees <= outerDegrees && outerDegrees < 90.0f;
+			}
+			std::string option;
+			light.castsShadow = (words >> option) && option == "shadow";
+			light.direction = valid ? glm::normalize(light.direction) : light.direction;
+			light.innerAngle = glm::radians(innerDegrees);
+			light.outerAngle = glm::radians(outerDegrees);
+			scene.lights.push_back(light);
+		}
+		else if (keyword == "object")
+		{
+			SceneObject object;
+			valid = static_cast<bool>(words >> object.mesh >> object.material);
+			object.position = glm::vec3(0.0f);
+			object.rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+			object.scale = glm::vec3(1.0f);
+			object.spinAxis = glm::vec3(0.0f, 1.0f, 0.0f);
+			object.spinSpeed = 0.0f;
+			scene.objects.push_back(object);
+		}
+		// the remaining keywords describe the most recent object
+		else if (scene.objects.empty())
+		{
+			std::cerr << path << ":" << lineNumber << ": '" << keyword << "' before any object" << std::endl;
+			return false;
+		}
+		else
+		{
+			SceneObject& object = scene.objects.back();
+			glm::vec3 value;
+			GLfloat degrees = 0.0f;
+			valid = static_cast<bool>(words >> value.x >> value.y >> value.z);
+			if (keyword == "position")
+			{
+				object.position = value;
+			}
+			else if (keyword == "scale")
+			{
+				object.scale = value;
+			}
+			// rotations apply in the order they are listed, like chained glm::rotate calls.
+			// a zero axis has no direction and would normalize to NaN
+			else if (keyword == "rotate" && (words >> degrees) && glm::length(value) > 0.0f)
+			{
+				object.rotation = object.rotation * glm::angleAxis(glm::radians(degrees), glm::normalize(value));
+			}
+			else if (keyword == "spin" && (words >> degrees) && glm::length(value) > 0.0f)
+			{
+				object.spinAxis = glm::normalize(value);
+				object.spinSpeed = degrees;
+			}
+			else
+			{
+				valid = false;
+			}
+		}
+
+		if (!valid)
+		{
+			std::cerr << path << ":" << lineNumber << ": malformed '" << keyword << "' line" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool MapFile(const std::string& path, MappedFile& mapped)
+{
+	mapped.data = nullptr;
+	mapped.size = 0;
+	// the view keeps the file alive, so the handles can be closed right away
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		std::cerr << "Failed to open " << path << std::endl;
+		return false;
+	}
+	LARGE_INTEGER size;
+	HANDLE mapping = nullptr;
+	if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+	{
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	}
+	if (mapping != nullptr)
+	{
+		mapped.data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		mapped.size = static_cast<size_t>(size.QuadPart);
+		CloseHandle(mapping);
+	}
+	CloseHandle(file);
+#else
+	int file = open(path.c_str(), O_RDONLY);
+	if (file < 0)
+	{
+		std::cerr << "Failed to open " << path << std::endl;
+		return false;
+	}
+	struct stat status;
+	if (fstat(file, &status) == 0 && status.st_size > 0)
+	{
+		void* data = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (data != MAP_FAILED)
+		{
+			mapped.data = static_cast<const uint8_t*>(data);
+			mapped.size = static_cast<size_t>(status.st_size);
+		}
+	}
+	close(file);
+#endif
+	if (mapped.data == nullptr)
+	{
+		std::cerr << "Failed to map " << path << std::endl;
+		mapped.size = 0;
+		return false;
+	}
+	return true;
+}
+
+void UnmapFile(MappedFile& mapped)
+{
+	if (mapped.data != nullptr)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(mapped.data);
+#else
+		munmap(const_cast<uint8_t*>(mapped.data), mapped.size);
+#endif
+	}
+	mapped.data = nullptr;
+	mapped.size = 0;
+}
+
+bool ValidateMeshFile(const std::string& path, const MappedFile& mapped)
+{
+	const MeshFileHeader* header = reinterpret_cast<const MeshFileHeader*>(mapped.data);
+	if (mapped.size < sizeof(MeshFileHeader) || memcmp(header->magic, MESH_FILE_MAGIC, sizeof(header->magic)) != 0)
+	{
+		std::cerr << path << " is not a mesh file, convert it with meshconv" << std::endl;
+		return false;
+	}
+	bool standard = header->layout == MESH_LAYOUT_STANDARD && header->positionSize == sizeof(StandardPosition)
+		&& header->attributeSize == sizeof(StandardAttributes);
+	bool compact = header->layout == MESH_LAYOUT_COMPACT && header->positionSize == sizeof(CompactPosition)
+		&& header->attributeSize == sizeof(CompactAttributes);
+	if (header->version != MESH_FILE_VERSION || (!standard && !compact))
+	{
+		std::cerr << path << " was written by a different meshconv version, convert it again" << std::endl;
+		return false;
+	}
+	uint64_t positionEnd = uint64_t(header->positionOffset) + uint64_t(header->vertexCount) * header->positionSize;
+	uint64_t attributeEnd = uint64_t(header->attributeOffset) + uint64_t(header->vertexCount) * header->attributeSize;
+	uint64_t indexEnd = uint64_t(header->indexOffset) + uint64_t(header->indexCount) * sizeof(uint32_t);
+	if (positionEnd > mapped.size || attributeEnd > mapped.size || indexEnd > mapped.size || header->indexCount % 3 != 0
+		|| header->indexOffset % sizeof(uint32_t) != 0)
+	{
+		std::cerr << path << " is truncated or corrupt" << std::endl;
+		return false;
+	}
+	// an index past the mesh's own vertices would reach into the next mesh through baseVertex, or past the buffers
+	const uint32_t* indices = reinterpret_cast<const uint32_t*>(mapped.data + header->indexOffset);
+	uint32_t maxIndex = 0;
+	for (uint32_t i = 0; i < header->indexCount; i++)
+	{
+		maxIndex = std::max(maxIndex, indices[i]);
+	}
+	if (header->indexCount > 0 && maxIndex >= header->vertexCount)
+	{
+		std::cerr << path << " is truncated or corrupt" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool UploadMeshes(const std::vector<SceneMesh>& sceneMeshes, GLuint vbo, GLuint attributeVbo, GLuint ebo, std::vector<Mesh>& meshes, MeshLayout& layout)
+{
+	// map everything first so the shared buffers can be allocated once
+	std::vector<MappedFile> files;
+	GLint vertexCount = 0;
+	GLuint indexCount = 0;
+	GLuint positionSize = 0, attributeSize = 0;
+	layout = MESH_LAYOUT_STANDARD;
+	bool valid = true;
+	for (const SceneMesh& sceneMesh : sceneMeshes)
+	{
+		MappedFile file;
+		if (!MapFile(sceneMesh.path, file))
+		{
+			valid = false;
+			break;
+		}
+		files.push_back(file);
+		if (!ValidateMeshFile(sceneMesh.path, file))
+		{
+			valid = false;
+			break;
+		}
+		const MeshFileHeader* header = reinterpret_cast<const MeshFileHeader*>(file.data);
+		if (files.size() == 1)
+		{
+			layout = static_cast<MeshLayout>(header->layout);
+			positionSize = header->positionSize;
+			attributeSize = header->attributeSize;
+		}
+		else if (header->layout != layout)
+		{
+			std::cerr << sceneMesh.path << " uses a different vertex layout than " << sceneMeshes[0].path << std::endl;
+			valid = false;
+			break;
+		}
+		Aabb bounds = { glm::vec3(header->boundsMin[0], header->boundsMin[1], header->boundsMin[2]),
+			glm::vec3(header->boundsMax[0], header->boundsMax[1], header->boundsMax[2]) };
+		meshes.push_back({ sceneMesh.name, indexCount, static_cast<GLsizei>(header->indexCount), vertexCount, bounds });
+		vertexCount += header->vertexCount;
+		indexCount += header->indexCount;
+	}
+
+	if (valid)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferData(GL_ARRAY_BUFFER, vertexCount * positionSize, nullptr, GL_STATIC_DRAW);
+		for (size_t i = 0; i < files.size(); i++)
+		{
+			const MeshFileHeader* header = reinterpret_cast<const MeshFileHeader*>(files[i].data);
+			glBufferSubData(GL_ARRAY_BUFFER, meshes[i].baseVertex * positionSize, header->vertexCount * positionSize,
+				files[i].data + header->positionOffset);
+		}
+
+		glBindBuffer(GL_ARRAY_BUFFER, attributeVbo);
+		glBufferData(GL_ARRAY_BUFFER, vertexCount * attributeSize, nullptr, GL_STATIC_DRAW);
+		for (size_t i = 0; i < files.size(); i++)
+		{
+			const MeshFileHeader* header = reinterpret_cast<const MeshFileHeader*>(files[i].data);
+			glBufferSubData(GL_ARRAY_BUFFER, meshes[i].baseVertex * attributeSize, header->vertexCount * attributeSize,
+				files[i].data + header->attributeOffset);
+		}
+
+		// no VAO is bound, so the element buffer binding here affects nothing else
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(uint32_t), nullptr, GL_STATIC_DRAW);
+		for (size_t i = 0; i < files.size(); i++)
+		{
+			const MeshFileHeader* header = reinterpret_cast<const MeshFileHeader*>(files[i].data);
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, meshes[i].firstIndex * sizeof(uint32_t), header->indexCount * sizeof(uint32_t),
+				files[i].data + header->indexOffset);
+		}
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+
+	for (MappedFile& file : files)
+	{
+		UnmapFile(file);
+	}
+	return valid;
+}
+
+void SetVertexAttributes(MeshLayout layout, GLuint vbo, GLuint attributeVbo, GLuint ebo, bool positionsOnly)
+{
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glEnableVertexAttribArray(0);
+	if (layout == MESH_LAYOUT_COMPACT)
+	{
+		glVertexAttribPointer(0, 3, GL_HALF_FLOAT, GL_FALSE, sizeof(CompactPosition), (void*)offsetof(CompactPosition, x));
+		if (!positionsOnly)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, attributeVbo);
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(CompactAttributes), (void*)offsetof(CompactAttributes, r));
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(CompactAttributes), (void*)offsetof(CompactAttributes, normal));
+		}
+	}
+	else
+	{
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(StandardPosition), (void*)offsetof(StandardPosition, x));
+		if (!positionsOnly)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, attributeVbo);
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(StandardAttributes), (void*)offsetof(StandardAttributes, r));
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(StandardAttributes), (void*)offsetof(StandardAttributes, nx));
+		}
+	}
+}
+
+void SetInstanceAttributes(GLuint instanceVbo, GLuint attributeCount)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+	// a mat4 attribute takes up 4 consecutive locations and a mat3 takes 3, one per column
+	for (GLuint i = 0; i < attributeCount; i++)
+	{
+		glEnableVertexAttribArray(INSTANCE_ATTRIBUTE_LOCATION + i);
+		glVertexAttribDivisor(INSTANCE_ATTRIBUTE_LOCATION + i, 1);
+	}
+	BindInstanceAttributes(0);
+}
+
+bool BuildRenderList(const Scene& scene, const std::vector<Mesh>& meshes, TransformStore& transforms, RenderList& renderList)
+{
+	struct ResolvedObject
+	{
+		const SceneObject* object;
+		size_t mesh;
+		size_t material;
+		bool dynamic;
+	};
+	std::vector<ResolvedObject> resolved;
+	for (const SceneObject& object : scene.objects)
+	{
+		ResolvedObject entry = { &object, meshes.size(), scene.materials.size(), object.spinSpeed != 0.0f };
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			if (meshes[i].name == object.mesh)
+			{
+				entry.mesh = i;
+			}
+		}
+		for (size_t i = 0; i < scene.materials.size(); i++)
+		{
+			if (scene.materials[i].name == object.material)
+			{
+				entry.material = i;
+			}
+		}
+		if (entry.mesh == meshes.size() || entry.material == scene.materials.size())
+		{
+			std::cerr << "Scene object refers to unknown mesh '" << object.mesh << "' or material '" << object.material << "'" << std::endl;
+			return false;
+		}
+		resolved.push_back(entry);
+	}
+
+	// static casters first so the shadow cache can draw them as one range, then group by mesh,
+	// and by material within a mesh so the per-object path repeats the same material uniform
+	std::stable_sort(resolved.begin(), resolved.end(), [](const ResolvedObject& a, const ResolvedObject& b)
+	{
+		if (a.dynamic != b.dynamic)
+		{
+			return !a.dynamic;
+		}
+		return a.mesh != b.mesh ? a.mesh < b.mesh : a.material < b.material;
+	});
+
+	renderList.instances.resize(resolved.size());
+	renderList.bounds.resize(resolved.size());
+	for (size_t i = 0; i < resolved.size(); i++)
+	{
+		renderList.instanceMeshes.push_back(resolved[i].mesh);
+		const SceneObject& object = *resolved[i].object;
+		const Material& material = scene.materials[resolved[i].material];
+		size_t transform = transforms.Add(object.position, object.rotation, object.scale);
+		renderList.instances[i].material = glm::vec4(material.color, material.shininess);
+		renderList.instances[i].textureParams = glm::vec4(static_cast<GLfloat>(material.textureLayer), 0.0f, 0.0f, 0.0f);
+		if (resolved[i].dynamic)
+		{
+			renderList.animations.push_back({ transform, object.rotation, object.spinAxis, object.spinSpeed });
+		}
+
+		if (renderList.batches.empty() || renderList.batches.back().mesh != resolved[i].mesh || renderList.batches.back().dynamic != resolved[i].dynamic)
+		{
+			renderList.batches.push_back({ resolved[i].mesh, static_cast<GLuint>(i), 0, resolved[i].dynamic });
+		}
+		renderList.batches.back().instanceCount++;
+	}
+	return true;
+}
+
+GLuint CreateShadowMapArray(GLuint width, GLuint height)
+{
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, width, height, CASCADE_COUNT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	// hardware depth comparison, with GL_LINEAR every fetch is already a 2x2 bilinear PCF tap
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	return texture;
+}
+
+GLuint CreateShadowAtlas(GLuint size)
+{
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	return texture;
+}
+
+void BuildLocalShadowViews(const std::vector<SceneLight>& lights, std::vector<ShadowView>& views, std::vector<ShadowedLight>& shadowedLights)
+{
+	// cube faces in the order main.fsh picks them
+	static const glm::vec3 faceDirections[6] =
+	{
+		glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1)
+	};
+	static const glm::vec3 faceUps[6] =
+	{
+		glm::vec3(0, 1, 0), glm::vec3(0, 1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, 1), glm::vec3(0, 1, 0), glm::vec3(0, 1, 0)
+	};
+
+	views.clear();
+	shadowedLights.clear();
+	for (size_t i = 0; i < lights.size(); i++)
+	{
+		const SceneLight& light = lights[i];
+		if (!light.castsShadow)
+		{
+			continue;
+		}
+
+		GLuint viewCount = light.type == LIGHT_POINT ? 6 : 1;
+		shadowedLights.push_back({ i, static_cast<GLuint>(views.size()), viewCount, 0, 1, 0, false });
+		for (GLuint face = 0; face < viewCount; face++)
+		{
+			glm::vec3 forward = light.type == LIGHT_POINT ? faceDirections[face] : light.direction;
+			glm::vec3 up = light.type == LIGHT_POINT ? faceUps[face] : std::abs(forward.y) > 0.99f ? glm::vec3(0, 0, 1) : glm::vec3(0, 1, 0);
+			GLfloat fieldOfView = light.type == LIGHT_POINT ? glm::radians(90.0f) : std::min(2.0f * light.outerAngle, glm::radians(170.0f));
+			glm::mat4 projection = glm::perspective(fieldOfView, 1.0f, LOCAL_SHADOW_NEAR_PLANE, light.range);
+			glm::mat4 view = glm::lookAt(light.position, light.position + forward, up);
+			views.push_back({ projection * view, light.position, forward, 0, 0, 0 });
+		}
+	}
+}
+
+void ResetShadowAtlas(ShadowAtlasAllocator& atlas, GLuint size, GLuint minTileSize)
+{
+	atlas.size = size;
+	atlas.levels.resize(1);
+	for (GLuint tileSize = size / 2; tileSize >= minTileSize; tileSize /= 2)
+	{
+		atlas.levels.emplace_back();
+	}
+	for (size_t level = 0; level < atlas.levels.size(); level++)
+	{
+		atlas.levels[level].assign(size_t(1) << (2 * level), SHADOW_NODE_FREE);
+	}
+}
+
+// quadtree level of a tile size, or levels.size() for sizes the atlas doesn't have
+static size_t ShadowAtlasLevel(const ShadowAtlasAllocator& atlas, GLuint tileSize)
+{
+	size_t level = 0;
+	while (level < atlas.levels.size() && (atlas.size >> level) != tileSize)
+	{
+		level++;
+	}
+	return level;
+}
+
+static bool AllocateShadowNode(ShadowAtlasAllocator& atlas, size_t level, GLuint nodeX, GLuint nodeY, size_t targetLevel, GLuint& x, GLuint& y)
+{
+	uint8_t& state = atlas.levels[level][(size_t(nodeY) << level) + nodeX];
+	if (state == SHADOW_NODE_USED)
+	{
+		return false;
+	}
+	if (level == targetLevel)
+	{
+		if (state != SHADOW_NODE_FREE)
+		{
+			return false;
+		}
+		state = SHADOW_NODE_USED;
+		x = nodeX * (atlas.size >> level);
+		y = nodeY * (atlas.size >> level);
+		return true;
+	}
+
+	bool wasFree = state == SHADOW_NODE_FREE;
+	state = SHADOW_NODE_SPLIT;
+	for (GLuint child = 0; child < 4; child++)
+	{
+		if (AllocateShadowNode(atlas, level + 1, nodeX * 2 + (child & 1), nodeY * 2 + (child >> 1), targetLevel, x, y))
+		{
+			return true;
+		}
+	}
+	if (wasFree)
+	{
+		state = SHADOW_NODE_FREE;
+	}
+	return false;
+}
+
+bool AllocateShadowTile(ShadowAtlasAllocator& atlas, GLuint tileSize, GLuint& x, GLuint& y)
+{
+	size_t level = ShadowAtlasLevel(atlas, tileSize);
+	return level < atlas.levels.size() && AllocateShadowNode(atlas, 0, 0, 0, level, x, y);
+}
+
+bool ReserveShadowTile(ShadowAtlasAllocator& atlas, GLuint tileSize, GLuint x, GLuint y)
+{
+	size_t targetLevel = ShadowAtlasLevel(atlas, tileSize);
+	if (targetLevel == atlas.levels.size() || x % tileSize != 0 || y % tileSize != 0)
+	{
+		return false;
+	}
+
+	// no ancestor may be handed out whole, and the tile itself must be untouched
+	for (size_t level = 0; level < targetLevel; level++)
+	{
+		GLuint nodeSize = atlas.size >> level;
+		if (atlas.levels[level][(size_t(y / nodeSize) << level) + x / nodeSize] == SHADOW_NODE_USED)
+		{
+			return false;
+		}
+	}
+	uint8_t& state = atlas.levels[targetLevel][(size_t(y / tileSize) << targetLevel) + x / tileSize];
+	if (state != SHADOW_NODE_FREE)
+	{
+		return false;
+	}
+
+	state = SHADOW_NODE_USED;
+	for (size_t level = 0; level < targetLevel; level++)
+	{
+		GLuint nodeSize = atlas.size >> level;
+		atlas.levels[level][(size_t(y / nodeSize) << level) + x / nodeSize] = SHADOW_NODE_SPLIT;
+	}
+	return true;
+}
+
+void FreeShadowTile(ShadowAtlasAllocator& atlas, GLuint tileSize, GLuint x, GLuint y)
+{
+	size_t level = ShadowAtlasLevel(atlas, tileSize);
+	if (level == atlas.levels.size())
+	{
+		return;
+	}
+	GLuint nodeX = x / tileSize, nodeY = y / tileSize;
+	atlas.levels[level][(size_t(nodeY) << level) + nodeX] = SHADOW_NODE_FREE;
+
+	// merge upwards while all four siblings are free
+	while (level > 0)
+	{
+		GLuint firstX = nodeX & ~1u, firstY = nodeY & ~1u;
+		const std::vector<uint8_t>& nodes = atlas.levels[level];
+		for (GLuint child = 0; child < 4; child++)
+		{
+			if (nodes[(size_t(firstY + (child >> 1)) << level) + firstX + (child & 1)] != SHADOW_NODE_FREE)
+			{
+				return;
+			}
+		}
+		level--;
+		nodeX /= 2;
+		nodeY /= 2;
+		atlas.levels[level][(size_t(nodeY) << level) + nodeX] = SHADOW_NODE_FREE;
+	}
+}
+
+static bool SphereInFrustum(const glm::vec3& center, GLfloat radius, const Frustum& frustum)
+{
+	for (const glm::vec4& plane : frustum.planes)
+	{
+		if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void AssignShadowAtlas(ShadowAtlasAllocator& atlas, std::vector<ShadowedLight>& shadowedLights, std::vector<ShadowView>& views,
+	const std::vector<SceneLight>& lights, const Frustum& cameraFrustum, const glm::vec3& cameraPosition, GLfloat screenScale, uint64_t frame,
+	GLuint refreshScale)
+{
+	// the size each light would like, 0 for lights that can't reach anything on screen
+	std::vector<GLuint> wantedSizes(shadowedLights.size(), 0);
+	std::vector<GLfloat> importance(shadowedLights.size(), 0.0f);
+	for (size_t i = 0; i < shadowedLights.size(); i++)
+	{
+		const SceneLight& light = lights[shadowedLights[i].light];
+		if (!SphereInFrustum(light.position, light.range, cameraFrustum))
+		{
+			continue;
+		}
+		// projected radius of the light's range, inside it the light covers the whole screen
+		GLfloat distance = std::max(glm::length(light.position - cameraPosition), light.range);
+		importance[i] = light.range / distance * screenScale;
+		GLuint size = SHADOW_ATLAS_MIN_TILE_SIZE;
+		while (size < SHADOW_ATLAS_MAX_TILE_SIZE && size < importance[i])
+		{
+			size *= 2;
+		}
+		wantedSizes[i] = size;
+	}
+
+	std::vector<size_t> order(shadowedLights.size());
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return importance[a] > importance[b]; });
+
+	// lights that still want last frame's size claim their old tiles first, so their depth stays valid
+	ResetShadowAtlas(atlas, SHADOW_ATLAS_SIZE, SHADOW_ATLAS_MIN_TILE_SIZE);
+	std::vector<uint8_t> kept(shadowedLights.size(), 0);
+	for (size_t i : order)
+	{
+		ShadowedLight& shadowed = shadowedLights[i];
+		if (wantedSizes[i] == 0 || wantedSizes[i] != shadowed.tileSize)
+		{
+			continue;
+		}
+		GLuint reserved = 0;
+		while (reserved < shadowed.viewCount)
+		{
+			const ShadowView& view = views[shadowed.firstView + reserved];
+			if (!ReserveShadowTile(atlas, view.size, view.x, view.y))
+			{
+				break;
+			}
+			reserved++;
+		}
+		kept[i] = reserved == shadowed.viewCount;
+		for (GLuint j = 0; !kept[i] && j < reserved; j++)
+		{
+			const ShadowView& view = views[shadowed.firstView + j];
+			FreeShadowTile(atlas, view.size, view.x, view.y);
+		}
+	}
+
+	// everything else gets new tiles, halving the size until all of its views fit
+	for (size_t i : order)
+	{
+		ShadowedLight& shadowed = shadowedLights[i];
+		if (kept[i])
+		{
+			shadowed.render = frame - shadowed.lastRendered >= shadowed.refreshInterval;
+		}
+		else
+		{
+			shadowed.tileSize = 0;
+			for (GLuint size = wantedSizes[i]; size >= SHADOW_ATLAS_MIN_TILE_SIZE && wantedSizes[i] > 0; size /= 2)
+			{
+				GLuint allocated = 0;
+				while (allocated < shadowed.viewCount)
+				{
+					ShadowView& view = views[shadowed.firstView + allocated];
+					if (!AllocateShadowTile(atlas, size, view.x, view.y))
+					{
+						break;
+					}
+					view.size = size;
+					allocated++;
+				}
+				if (allocated == shadowed.viewCount)
+				{
+					shadowed.tileSize = size;
+					break;
+				}
+				for (GLuint j = 0; j < allocated; j++)
+				{
+					const ShadowView& view = views[shadowed.firstView + j];
+					FreeShadowTile(atlas, view.size, view.x, view.y);
+				}
+			}
+			shadowed.render = shadowed.tileSize > 0;
+		}
+
+		// the smaller a light's tiles, the less a stale frame shows
+		shadowed.refreshInterval = (shadowed.tileSize >= 512 ? 1 : shadowed.tileSize >= 256 ? 2 : 4) * refreshScale;
+		if (shadowed.render)
+		{
+			shadowed.lastRendered = frame;
+		}
+	}
+}
+
+GLuint CreateMomentsArray(GLuint width, GLuint height, GLuint layers, bool mipmapped)
+{
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+	GLint levels = 1;
+	if (mipmapped)
+	{
+		while ((std::max(width, height) >> levels) > 0)
+		{
+			levels++;
+		}
+	}
+	for (GLint level = 0; level < levels; level++)
+	{
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RG32F, std::max(width >> level, 1u), std::max(height >> level, 1u), layers, 0, GL_RG, GL_FLOAT, nullptr);
+	}
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, mipmapped ? GL_LINEAR : GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	return texture;
+}
+
+bool KeyPressedOnce(GLFWwindow* window, int key, bool& wasPressed)
+{
+	bool isPressed = glfwGetKey(window, key) == GLFW_PRESS;
+	bool pressedOnce = isPressed && !wasPressed;
+	wasPressed = isPressed;
+	return pressedOnce;
+}
+
+void FramebufferSizeChangedCallback(GLFWwindow* window, int width, int height)
+{
+	// Whenever the size of the framebuffer changed (due to window resizing, etc.),
+	// update the dimensions of the region to the new size
+	glViewport(0, 0, width, height);
+}
+
+void UpdateWorldBounds(RenderList& renderList, const std::vector<Mesh>& meshes, size_t instance)
+{
+	renderList.bounds[instance] = TransformAabb(meshes[renderList.instanceMeshes[instance]].bounds, renderList.instances[instance].model);
+}
+
+void AppendVisibleBatches(const RenderList& renderList, const std::vector<uint8_t>& visible,
+	std::vector<InstanceData>& culledInstances, std::vector<RenderBatch>& batches)
+{
+	batches.clear();
+	for (const RenderBatch& batch : renderList.batches)
+	{
+		GLuint first = static_cast<GLuint>(culledInstances.size());
+		for (GLuint i = batch.firstInstance; i < batch.firstInstance + batch.instanceCount; i++)
+		{
+			if (visible[i])
+			{
+				culledInstances.push_back(renderList.instances[i]);
+			}
+		}
+		GLuint count = static_cast<GLuint>(culledInstances.size()) - first;
+		if (count > 0)
+		{
+			batches.push_back({ batch.mesh, first, count, batch.dynamic });
+		}
+	}
+}
+
+Aabb TransformAabb(const Aabb& box, const glm::mat4& transform)
+{
+	// transform the center, the extents grow by the absolute value of the rotation and scale
+	glm::vec3 center = (box.min + box.max) * 0.5f;
+	glm::vec3 extent = (box.max - box.min) * 0.5f;
+	glm::vec3 worldCenter = glm::vec3(transform * glm::vec4(center, 1.0f));
+	glm::vec3 worldExtent(0.0f);
+	for (int column = 0; column < 3; column++)
+	{
+		for (int row = 0; row < 3; row++)
+		{
+			worldExtent[row] += std::abs(transform[column][row]) * extent[column];
+		}
+	}
+	return { worldCenter - worldExtent, worldCenter + worldExtent };
+}
+
+Frustum FrustumFromViewProjection(const glm::mat4& viewProjection)
+{
+	// each plane is the last row of the matrix plus or minus one of the others (Gribb and Hartmann)
+	glm::vec4 rows[4];
+	for (int row = 0; row < 4; row++)
+	{
+		rows[row] = glm::vec4(viewProjection[0][row], viewProjection[1][row], viewProjection[2][row], viewProjection[3][row]);
+	}
+	Frustum frustum;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		frustum.planes[axis * 2] = rows[3] + rows[axis];
+		frustum.planes[axis * 2 + 1] = rows[3] - rows[axis];
+	}
+	return frustum;
+}
+
+// 0 when the box is outside the frustum, 1 when it crosses a plane, 2 when it is fully inside
+static int ClassifyAabb(const Aabb& box, const Frustum& frustum)
+{
+	int result = 2;
+	for (const glm::vec4& plane : frustum.planes)
+	{
+		// the corners furthest along and against the plane normal
+		glm::vec3 inner(plane.x > 0 ? box.max.x : box.min.x, plane.y > 0 ? box.max.y : box.min.y, plane.z > 0 ? box.max.z : box.min.z);
+		glm::vec3 outer(plane.x > 0 ? box.min.x : box.max.x, plane.y > 0 ? box.min.y : box.max.y, plane.z > 0 ? box.min.z : box.max.z);
+		if (glm::dot(glm::vec3(plane), inner) + plane.w < 0)
+		{
+			return 0;
+		}
+		if (glm::dot(glm::vec3(plane), outer) + plane.w < 0)
+		{
+			result = 1;
+		}
+	}
+	return result;
+}
+
+static glm::vec3 AabbCenter(const Aabb& box)
+{
+	return (box.min + box.max) * 0.5f;
+}
+
+static void ExpandAabb(Aabb& box, const Aabb& other)
+{
+	box.min = glm::min(box.min, other.min);
+	box.max = glm::max(box.max, other.max);
+}
+
+void BuildBvh(Bvh& bvh, const std::vector<Aabb>& bounds)
+{
+	bvh.nodes.clear();
+	bvh.items.resize(bounds.size());
+	for (GLuint i = 0; i < bounds.size(); i++)
+	{
+		bvh.items[i] = i;
+	}
+	if (bounds.empty())
+	{
+		return;
+	}
+
+	// nodes are split in the order they were created, which keeps every child after its parent
+	bvh.nodes.push_back({ bounds[0], 0, static_cast<GLuint>(bounds.size()) });
+	for (size_t nodeIndex = 0; nodeIndex < bvh.nodes.size(); nodeIndex++)
+	{
+		GLuint first = bvh.nodes[nodeIndex].first;
+		GLuint count = bvh.nodes[nodeIndex].count;
+		Aabb nodeBounds = bounds[bvh.items[first]];
+		Aabb centers = { AabbCenter(nodeBounds), AabbCenter(nodeBounds) };
+		for (GLuint i = first + 1; i < first + count; i++)
+		{
+			const Aabb& itemBounds = bounds[bvh.items[i]];
+			ExpandAabb(nodeBounds, itemBounds);
+			ExpandAabb(centers, { AabbCenter(itemBounds), AabbCenter(itemBounds) });
+		}
+		bvh.nodes[nodeIndex].bounds = nodeBounds;
+		if (count <= BVH_LEAF_SIZE)
+		{
+			continue;
+		}
+
+		glm::vec3 spread = centers.max - centers.min;
+		int axis = spread.x > spread.y ? (spread.x > spread.z ? 0 : 2) : (spread.y > spread.z ? 1 : 2);
+		GLuint half = count / 2;
+		std::nth_element(bvh.items.begin() + first, bvh.items.begin() + first + half, bvh.items.begin() + first + count,
+			[&](GLuint a, GLuint b) { return AabbCenter(bounds[a])[axis] < AabbCenter(bounds[b])[axis]; });
+
+		GLuint left = static_cast<GLuint>(bvh.nodes.size());
+		bvh.nodes[nodeIndex].first = left;
+		bvh.nodes[nodeIndex].count = 0;
+		bvh.nodes.push_back({ nodeBounds, first, half });
+		bvh.nodes.push_back({ nodeBounds, first + half, count - half });
+	}
+}
+
+void RefitBvh(Bvh& bvh, const std::vector<Aabb>& bounds)
+{
+	for (size_t nodeIndex = bvh.nodes.size(); nodeIndex-- > 0;)
+	{
+		BvhNode& node = bvh.nodes[nodeIndex];
+		if (node.count == 0)
+		{
+			node.bounds = bvh.nodes[node.first].bounds;
+			ExpandAabb(node.bounds, bvh.nodes[node.first + 1].bounds);
+		}
+		else
+		{
+			node.bounds = bounds[bvh.items[node.first]];
+			for (GLuint i = node.first + 1; i < node.first + node.count; i++)
+			{
+				ExpandAabb(node.bounds, bounds[bvh.items[i]]);
+			}
+		}
+	}
+}
+
+void CullBvh(const Bvh& bvh, const std::vector<Aabb>& bounds, const Frustum& frustum, std::vector<uint8_t>& visible)
+{
+	if (bvh.nodes.empty())
+	{
+		return;
+	}
+
+	// a node fully inside the frustum accepts its whole subtree without further tests
+	std::vector<std::pair<GLuint, bool>> stack = { { 0, false } };
+	while (!stack.empty())
+	{
+		GLuint nodeIndex = stack.back().first;
+		bool inside = stack.back().second;
+		stack.pop_back();
+
+		const BvhNode& node = bvh.nodes[nodeIndex];
+		if (!inside)
+		{
+			int classification = ClassifyAabb(node.bounds, frustum);
+			if (classification == 0)
+			{
+				continue;
+			}
+			inside = classification == 2;
+		}
+
+		if (node.count == 0)
+		{
+			stack.push_back({ node.first, inside });
+			stack.push_back({ node.first + 1, inside });
+		}
+		else
+		{
+			for (GLuint i = node.first; i < node.first + node.count; i++)
+			{
+				GLuint item = bvh.items[i];
+				if (inside || ClassifyAabb(bounds[item], frustum) != 0)
+				{
+					visible[item] = 1;
+				}
+			}
+		}
+	}
+}
+
+void RunCullView(const RenderList& renderList, CullView& view)
+{
+	view.visible.assign(renderList.instances.size(), 0);
+	for (int i = 0; i < view.frustumCount; i++)
+	{
+		CullBvh(renderList.bvh, renderList.bounds, view.frustums[i], view.visible);
+	}
+	view.instances.clear();
+	AppendVisibleBatches(renderList, view.visible, view.instances, view.batches);
+
+	// instanced materials travel in the instance stream, so no batch ever switches material state
+	view.queue.clear();
+	for (size_t i = 0; i < view.batches.size(); i++)
+	{
+		const RenderBatch& batch = view.batches[i];
+		float nearest = INFINITY;
+		for (GLuint j = batch.firstInstance; j < batch.firstInstance + batch.instanceCount; j++)
+		{
+			nearest = std::min(nearest, glm::dot(view.depthPlane, view.instances[j].model[3]));
+		}
+		view.queue.push_back({ MakeDrawSortKey(view.pass, view.program, 0, static_cast<uint32_t>(batch.mesh), nearest), static_cast<uint32_t>(i) });
+	}
+	std::sort(view.queue.begin(), view.queue.end(), [](const DrawItem& a, const DrawItem& b) { return a.key < b.key; });
+}
+
+uint64_t MakeDrawSortKey(uint32_t pass, uint32_t program, uint32_t material, uint32_t mesh, float depth)
+{
+	// flip the float so its bits compare like the value, negative depths included
+	uint32_t depthBits;
+	std::memcpy(&depthBits, &depth, sizeof(depthBits));
+	depthBits = (depthBits & 0x80000000u) ? ~depthBits : depthBits | 0x80000000u;
+	return (uint64_t(pass & 0xf) << 60) | (uint64_t(program & 0xfff) << 48) | (uint64_t(material & 0xffff) << 32)
+		| (uint64_t(mesh & 0xffff) << 16) | (depthBits >> 16);
+}
+
+void InvalidateGlStateCache(GlStateCache& state)
+{
+	state.program = UNKNOWN_BINDING;
+	state.vertexArray = UNKNOWN_BINDING;
+	state.arrayBuffer = UNKNOWN_BINDING;
+	state.uniformBuffer = UNKNOWN_BINDING;
+	state.shaderStorageBuffer = UNKNOWN_BINDING;
+	state.drawIndirectBuffer = UNKNOWN_BINDING;
+	state.activeTextureUnit = UNKNOWN_BINDING;
+	for (GLuint unit = 0; unit < STATE_CACHE_TEXTURE_UNITS; unit++)
+	{
+		state.textures[unit] = UNKNOWN_BINDING;
+		state.textureTargets[unit] = GL_NONE;
+	}
+}
+
+void UseProgram(GlStateCache& state, GLuint program)
+{
+	if (state.program != program)
+	{
+		glUseProgram(program);
+		state.program = program;
+	}
+}
+
+void BindVertexArray(GlStateCache& state, GLuint vertexArray)
+{
+	if (state.vertexArray != vertexArray)
+	{
+		glBindVertexArray(vertexArray);
+		state.vertexArray = vertexArray;
+	}
+}
+
+void BindBuffer(GlStateCache& state, GLenum target, GLuint buffer)
+{
+	GLuint* cached = nullptr;
+	switch (target)
+	{
+	case GL_ARRAY_BUFFER: cached = &state.arrayBuffer; break;
+	case GL_UNIFORM_BUFFER: cached = &state.uniformBuffer; break;
+	case GL_SHADER_STORAGE_BUFFER: cached = &state.shaderStorageBuffer; break;
+	case GL_DRAW_INDIRECT_BUFFER: cached = &state.drawIndirectBuffer; break;
+	}
+	if (cached == nullptr || *cached != buffer)
+	{
+		glBindBuffer(target, buffer);
+		if (cached != nullptr)
+		{
+			*cached = buffer;
+		}
+	}
+}
+
+void BindBufferRange(GlStateCache& state, GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+	glBindBufferRange(target, index, buffer, offset, size);
+	switch (target)
+	{
+	case GL_UNIFORM_BUFFER: state.uniformBuffer = buffer; break;
+	case GL_SHADER_STORAGE_BUFFER: state.shaderStorageBuffer = buffer; break;
+	}
+}
+
+void BindTexture(GlStateCache& state, GLuint unit, GLenum target, GLuint texture)
+{
+	if (unit < STATE_CACHE_TEXTURE_UNITS && state.textures[unit] == texture && state.textureTargets[unit] == target)
+	{
+		return;
+	}
+	if (state.activeTextureUnit != unit)
+	{
+		glActiveTexture(GL_TEXTURE0 + unit);
+		state.activeTextureUnit = unit;
+	}
+	glBindTexture(target, texture);
+	if (unit < STATE_CACHE_TEXTURE_UNITS)
+	{
+		state.textures[unit] = texture;
+		state.textureTargets[unit] = target;
+	}
+}
+
+void DeleteBuffer(GlStateCache& state, GLuint buffer)
+{
+	glDeleteBuffers(1, &buffer);
+	GLuint* bindings[] = { &state.arrayBuffer, &state.uniformBuffer, &state.shaderStorageBuffer, &state.drawIndirectBuffer };
+	for (GLuint* binding : bindings)
+	{
+		if (*binding == buffer)
+		{
+			*binding = 0;
+		}
+	}
+}
+
+// the calling thread's queue and the system it belongs to, threads outside that system use its queue 0
+struct JobQueueOwner
+{
+	const JobSystem* jobs;
+	size_t index;
+};
+static thread_local JobQueueOwner currentJobQueue = { nullptr, 0 };
+
+static size_t CurrentJobQueue(const JobSystem& jobs)
+{
+	return currentJobQueue.jobs == &jobs ? currentJobQueue.index : 0;
+}
+
+// pops from the back of the caller's queue, or steals from the front of another one
+static bool TakeJob(JobSystem& jobs, Job& job)
+{
+	size_t queueCount = jobs.queues.size();
+	size_t ownQueue = CurrentJobQueue(jobs);
+	for (size_t attempt = 0; attempt < queueCount; attempt++)
+	{
+		size_t index = (ownQueue + attempt) % queueCount;
+		JobQueue& queue = *jobs.queues[index];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.jobs.empty())
+		{
+			continue;
+		}
+		if (attempt == 0)
+		{
+			job = std::move(queue.jobs.back());
+			queue.jobs.pop_back();
+		}
+		else
+		{
+			job = std::move(queue.jobs.front());
+			queue.jobs.pop_front();
+		}
+		jobs.queuedJobs--;
+		return true;
+	}
+	return false;
+}
+
+static void RunJob(Job& job)
+{
+	job.function();
+	job.counter->fetch_sub(1, std::memory_order_release);
+}
+
+void StartJobSystem(JobSystem& jobs, unsigned workerCount)
+{
+	if (workerCount == 0)
+	{
+		workerCount = std::max(1u, std::thread::hardware_concurrency()) - 1;
+	}
+	jobs.running = true;
+	jobs.queuedJobs = 0;
+	for (unsigned i = 0; i <= workerCount; i++)
+	{
+		jobs.queues.push_back(std::make_unique<JobQueue>());
+	}
+	for (unsigned i = 1; i <= workerCount; i++)
+	{
+		jobs.workers.emplace_back([&jobs, i]()
+		{
+			currentJobQueue = { &jobs, i };
+			while (jobs.running)
+			{
+				Job job;
+				if (TakeJob(jobs, job))
+				{
+					RunJob(job);
+					continue;
+				}
+				std::unique_lock<std::mutex> lock(jobs.sleepMutex);
+				jobs.wake.wait(lock, [&jobs]() { return jobs.queuedJobs > 0 || !jobs.running; });
+			}
+		});
+	}
+}
+
+void StopJobSystem(JobSystem& jobs)
+{
+	{
+		std::lock_guard<std::mutex> lock(jobs.sleepMutex);
+		jobs.running = false;
+	}
+	jobs.wake.notify_all();
+	for (std::thread& worker : jobs.workers)
+	{
+		worker.join();
+	}
+	jobs.workers.clear();
+	jobs.queues.clear();
+}
+
+void SubmitJob(JobSystem& jobs, JobCounter& counter, std::function<void()> function)
+{
+	counter++;
+	{
+		JobQueue& queue = *jobs.queues[CurrentJobQueue(jobs)];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back({ std::move(function), &counter });
+	}
+	// taking the sleep lock orders the increment against a worker checking its wait condition
+	{
+		std::lock_guard<std::mutex> lock(jobs.sleepMutex);
+		jobs.queuedJobs++;
+	}
+	jobs.wake.notify_one();
+}
+
+void WaitForJobs(JobSystem& jobs, JobCounter& counter)
+{
+	while (counter.load(std::memory_order_acquire) > 0)
+	{
+		Job job;
+		if (TakeJob(jobs, job))
+		{
+			RunJob(job);
+		}
+		else
+		{
+			// the remaining jobs are running on other threads
+			std::this_thread::yield();
+		}
+	}
+}
+
+void ParallelFor(JobSystem& jobs, size_t count, size_t grain, const std::function<void(size_t, size_t)>& function)
+{
+	if (count <= grain)
+	{
+		if (count > 0)
+		{
+			function(0, count);
+		}
+		return;
+	}
+	JobCounter counter(0);
+	for (size_t first = 0; first < count; first += grain)
+	{
+		size_t last = std::min(count, first + grain);
+		SubmitJob(jobs, counter, [&function, first, last]() { function(first, last); });
+	}
+	WaitForJobs(jobs, counter);
+}
+
+void CreateFrameProfiler(FrameProfiler& profiler)
+{
+	glGenQueries(PROFILER_QUERY_FRAMES * PROFILE_SECTION_COUNT * 2, &profiler.queries[0][0][0]);
+	for (int slot = 0; slot < PROFILER_QUERY_FRAMES; slot++)
+	{
+		for (int section = 0; section < PROFILE_SECTION_COUNT; section++)
+		{
+			profiler.pending[slot][section] = ProfileSample{ 0, 0.0f, 0.0f, 0, 0 };
+			profiler.issued[slot][section] = false;
+		}
+	}
+	for (int section = 0; section < PROFILE_SECTION_COUNT; section++)
+	{
+		profiler.open[section] = false;
+	}
+	profiler.slot = 0;
+}
+
+void DeleteFrameProfiler(FrameProfiler& profiler)
+{
+	StopProfileRecording(profiler);
+	glDeleteQueries(PROFILER_QUERY_FRAMES * PROFILE_SECTION_COUNT * 2, &profiler.queries[0][0][0]);
+}
+
+void BeginProfileFrame(FrameProfiler& profiler, uint64_t frame)
+{
+	int slot = static_cast<int>(frame % PROFILER_QUERY_FRAMES);
+	profiler.slot = slot;
+	for (int section = 0; section < PROFILE_SECTION_COUNT; section++)
+	{
+		if (!profiler.issued[slot][section])
+		{
+			continue;
+		}
+		profiler.issued[slot][section] = false;
+
+		// timestamps complete in order, so the end being available means the begin is too.
+		// a GPU more than PROFILER_QUERY_FRAMES behind loses the sample instead of stalling the loop
+		GLuint available = 0;
+		glGetQueryObjectuiv(profiler.queries[slot][section][1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+		{
+			continue;
+		}
+		GLuint64 begin, end;
+		glGetQueryObjectui64v(profiler.queries[slot][section][0], GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(profiler.queries[slot][section][1], GL_QUERY_RESULT, &end);
+
+		ProfileSample& sample = profiler.pending[slot][section];
+		sample.gpuMilliseconds = (end - begin) / 1000000.0f;
+		std::deque<ProfileSample>& history = profiler.history[section];
+		history.push_back(sample);
+		if (history.size() > PROFILER_HISTORY_FRAMES)
+		{
+			history.pop_front();
+		}
+		if (profiler.csv.is_open())
+		{
+			profiler.csv << sample.frame << ',' << PROFILE_SECTION_NAMES[section] << ',' << sample.cpuMilliseconds << ','
+				<< sample.gpuMilliseconds << ',' << sample.drawCalls << ',' << sample.triangles << '\n';
+		}
+	}
+	for (int section = 0; section < PROFILE_SECTION_COUNT; section++)
+	{
+		profiler.pending[slot][section] = ProfileSample{ frame, 0.0f, 0.0f, 0, 0 };
+	}
+}
+
+void BeginProfileSection(FrameProfiler& profiler, ProfileSection section)
+{
+	glQueryCounter(profiler.queries[profiler.slot][section][0], GL_TIMESTAMP);
+	profiler.cpuStarts[section] = std::chrono::steady_clock::now();
+	profiler.open[section] = true;
+	profiler.issued[profiler.slot][section] = true;
+}
+
+void EndProfileSection(FrameProfiler& profiler, ProfileSection section)
+{
+	glQueryCounter(profiler.queries[profiler.slot][section][1], GL_TIMESTAMP);
+	std::chrono::duration<GLfloat, std::milli> elapsed = std::chrono::steady_clock::now() - profiler.cpuStarts[section];
+	profiler.pending[profiler.slot][section].cpuMilliseconds = elapsed.count();
+	profiler.open[section] = false;
+}
+
+void CountProfileDraw(FrameProfiler& profiler, GLuint64 triangles)
+{
+	for (int section = 0; section < PROFILE_SECTION_COUNT; section++)
+	{
+		if (profiler.open[section])
+		{
+			profiler.pending[profiler.slot][section].drawCalls++;
+			profiler.pending[profiler.slot][section].triangles += triangles;
+		}
+	}
+}
+
+ProfileStats ComputeStats(std::vector<GLfloat>& milliseconds)
+{
+	if (milliseconds.empty())
+	{
+		return ProfileStats{ 0.0f, 0.0f, 0.0f };
+	}
+	GLfloat sum = 0.0f;
+	for (GLfloat value : milliseconds)
+	{
+		sum += value;
+	}
+	std::sort(milliseconds.begin(), milliseconds.end());
+	size_t p99Index = std::min(milliseconds.size() - 1, static_cast<size_t>(std::ceil(milliseconds.size() * 0.99)) - 1);
+	return ProfileStats{ milliseconds.front(), sum / milliseconds.size(), milliseconds[p99Index] };
+}
+
+ProfileStats ComputeProfileStats(const FrameProfiler& profiler, ProfileSection section, bool gpu)
+{
+	const std::deque<ProfileSample>& history = profiler.history[section];
+	std::vector<GLfloat> values;
+	values.reserve(history.size());
+	for (const ProfileSample& sample : history)
+	{
+		values.push_back(gpu ? sample.gpuMilliseconds : sample.cpuMilliseconds);
+	}
+	return ComputeStats(values);
+}
+
+std::string FormatProfileSummary(const FrameProfiler& profiler)
+{
+	// gpu min/avg/p99 and cpu average per section, with the draws and triangles of its latest resolved frame
+	std::ostringstream summary;
+	summary << std::fixed << std::setprecision(2);
+	bool first = true;
+	for (int section = 0; section < PROFILE_SECTION_COUNT; section++)
+	{
+		if (profiler.history[section].empty())
+		{
+			continue;
+		}
+		ProfileStats gpu = ComputeProfileStats(profiler, static_cast<ProfileSection>(section), true);
+		ProfileStats cpu = ComputeProfileStats(profiler, static_cast<ProfileSection>(section), false);
+		const ProfileSample& latest = profiler.history[section].back();
+		// sections without history are skipped, so the separator goes before every field but the first written
+		if (!first)
+		{
+			summary << " | ";
+		}
+		first = false;
+		summary << PROFILE_SECTION_NAMES[section] << " gpu " << gpu.min << "/" << gpu.average << "/" << gpu.p99
+			<< " cpu " << cpu.average << " ms, " << latest.drawCalls << " draws " << latest.triangles / 1000 << "k tris";
+	}
+	return summary.str();
+}
+
+bool StartProfileRecording(FrameProfiler& profiler, const std::string& path)
+{
+	profiler.csv.open(path, std::ios::out | std::ios::trunc);
+	if (!profiler.csv.is_open())
+	{
+		std::cerr << "Failed to open " << path << " for profiling!" << std::endl;
+		return false;
+	}
+	profiler.csv << "frame,section,cpu_ms,gpu_ms,draw_calls,triangles\n";
+	return true;
+}
+
+void StopProfileRecording(FrameProfiler& profiler)
+{
+	if (profiler.csv.is_open())
+	{
+		profiler.csv.close();
+	}
+}
+
+bool ParseCommandLine(int argc, char* argv[], BenchmarkSettings& settings, FramePacingSettings& framePacing)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		bool valid = true;
+		if (argument == "--benchmark")
+		{
+			settings.enabled = true;
+		}
+		else if (argument == "--shadow-budget" && i + 1 < argc)
+		{
+			std::istringstream value(argv[++i]);
+			valid = (value >> settings.shadowBudget) && value.eof() && settings.shadowBudget >= 0.0f;
+		}
+		else if ((argument == "--objects" || argument == "--shadow-size" || argument == "--frames"
+			|| argument == "--swap-interval" || argument == "--fps-limit") && i + 1 < argc)
+		{
+			std::istringstream value(argv[++i]);
+			long long number = 0;
+			valid = (value >> number) && value.eof() && number >= 0;
+			if (argument == "--objects")
+			{
+				settings.objectCount = static_cast<size_t>(number);
+			}
+			else if (argument == "--shadow-size")
+			{
+				valid = valid && number >= 64 && number <= 16384;
+				settings.shadowSize = static_cast<GLuint>(number);
+			}
+			else if (argument == "--frames")
+			{
+				valid = valid && number > 0;
+				settings.frames = static_cast<int>(number);
+			}
+			else if (argument == "--swap-interval")
+			{
+				valid = valid && number <= 4;
+				framePacing.swapInterval = static_cast<int>(number);
+			}
+			else
+			{
+				framePacing.frameRateLimit = static_cast<GLfloat>(number);
+			}
+		}
+		else
+		{
+			valid = false;
+		}
+
+		if (!valid)
+		{
+			std::cerr << "Invalid argument " << argument << std::endl;
+			std::cerr << "usage: " << argv[0] << " [--benchmark] [--objects <count>] [--shadow-size <64 to 16384>] [--shadow-budget <ms, 0 for fixed quality>] [--frames <count>]"
+				" [--swap-interval <0 to 4>] [--fps-limit <frames per second, 0 for none>]" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+void GenerateBenchmarkScene(Scene& scene, size_t objectCount)
+{
+	std::vector<SceneObject> tile = scene.objects;
+	scene.objects.clear();
+	if (tile.empty())
+	{
+		return;
+	}
+	size_t tileCount = (objectCount + tile.size() - 1) / tile.size();
+	size_t gridSize = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(tileCount))));
+	GLfloat gridCenter = (gridSize - 1) * 0.5f;
+	scene.objects.reserve(objectCount);
+	for (size_t i = 0; i < objectCount; i++)
+	{
+		size_t tileIndex = i / tile.size();
+		glm::vec3 offset((tileIndex % gridSize - gridCenter) * BENCHMARK_TILE_SPACING, 0.0f,
+			(tileIndex / gridSize - gridCenter) * BENCHMARK_TILE_SPACING);
+		SceneObject object = tile[i % tile.size()];
+		object.position += offset;
+		scene.objects.push_back(object);
+	}
+}
+
+GLfloat BenchmarkOrbitRadius(size_t objectCount, size_t objectsPerTile)
+{
+	size_t tileCount = (objectCount + objectsPerTile - 1) / std::max<size_t>(objectsPerTile, 1);
+	GLfloat gridSize = std::ceil(std::sqrt(static_cast<GLfloat>(tileCount)));
+	return std::max(8.0f, gridSize * BENCHMARK_TILE_SPACING * 0.5f);
+}
+
+void BenchmarkCameraPath(GLfloat time, GLfloat radius, glm::vec3& position, GLfloat& horizontalAngle, GLfloat& verticalAngle)
+{
+	// a slow bob keeps the cascades refitting as they would under a moving player
+	GLfloat orbitAngle = 2.0f * M_PI * time / BENCHMARK_ORBIT_SECONDS;
+	GLfloat height = radius * (0.35f + 0.15f * std::sin(orbitAngle * 3.0f));
+	position = glm::vec3(radius * std::sin(orbitAngle), height, radius * std::cos(orbitAngle));
+	horizontalAngle = orbitAngle + M_PI;
+	verticalAngle = -std::atan2(height, radius);
+}
+
+bool WriteBenchmarkResults(const std::string& path, const std::vector<BenchmarkConfiguration>& configurations,
+	const BenchmarkSettings& settings, const int pcfKernelTaps[], size_t objectCount)
+{
+	std::ofstream csv(path, std::ios::trunc);
+	if (!csv)
+	{
+		std::cerr << "Failed to open " << path << " for the benchmark results!" << std::endl;
+		return false;
+	}
+	csv << "shadow_size,cascades,pcf_taps,submission,objects,frames,"
+		"cpu_min_ms,cpu_avg_ms,cpu_p99_ms,gpu_min_ms,gpu_avg_ms,gpu_p99_ms" << std::endl;
+	csv << std::fixed << std::setprecision(3);
+	for (BenchmarkConfiguration configuration : configurations)
+	{
+		ProfileStats cpu = ComputeStats(configuration.cpuMilliseconds);
+		ProfileStats gpu = ComputeStats(configuration.gpuMilliseconds);
+		const char* submission = configuration.gpuDriven ? "gpu-driven" : configuration.instanced ? "instanced" : "per-object";
+		csv << settings.shadowSize << ',' << CASCADE_COUNT << ',' << pcfKernelTaps[configuration.pcfKernel] << ','
+			<< submission << ',' << objectCount << ',' << configuration.cpuMilliseconds.size() << ','
+			<< cpu.min << ',' << cpu.average << ',' << cpu.p99 << ','
+			<< gpu.min << ',' << gpu.average << ',' << gpu.p99 << std::endl;
+	}
+	return true;
+}
+
+void CameraBasis(GLfloat horizontalAngle, GLfloat verticalAngle, glm::vec3& direction, glm::vec3& right, glm::vec3& up)
+{
+	direction = glm::vec3(cos(verticalAngle) * sin(horizontalAngle), sin(verticalAngle), cos(verticalAngle) * cos(horizontalAngle));
+	right = glm::vec3(sin(horizontalAngle - M_PI / 2.0f), 0.0f, cos(horizontalAngle - M_PI / 2.0f));
+	up = glm::cross(right, direction);
+}
+
+void StepSimulation(GLFWwindow* window, SimulationState& state, GLfloat timestep, GLfloat speed)
+{
+	glm::vec3 direction, right, up;
+	CameraBasis(state.horizontalAngle, state.verticalAngle, direction, right, up);
+	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
+		state.position += direction * timestep * speed;
+	}
+	if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) {
+		state.position -= direction * timestep * speed;
+	}
+	if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
+		state.position += right * timestep * speed;
+	}
+	if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) {
+		state.position -= right * timestep * speed;
+	}
+	state.time += timestep;
+}
+
+void WaitForFrameDeadline(std::chrono::steady_clock::time_point& deadline, std::chrono::steady_clock::duration interval)
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (deadline - now > FRAME_LIMITER_SPIN_TIME)
+	{
+		std::this_thread::sleep_until(deadline - FRAME_LIMITER_SPIN_TIME);
+	}
+	while (std::chrono::steady_clock::now() < deadline)
+	{
+		std::this_thread::yield();
+	}
+	// a frame that ran over starts the schedule again rather than rushing the next ones
+	now = std::chrono::steady_clock::now();
+	deadline = deadline + interval < now ? now + interval : deadline + interval;
+}
+
+bool CreateStreamBuffer(StreamBuffer& stream, GLsizeiptr regionSize, GLsizeiptr alignment)
+{
+	stream.alignment = std::max<GLsizeiptr>(alignment, 1);
+	stream.regionSize = (regionSize + stream.alignment - 1) / stream.alignment * stream.alignment;
+	stream.region = 0;
+	stream.offset = 0;
+	stream.persistent = GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage;
+	stream.mapped = nullptr;
+	std::fill(stream.fences, stream.fences + STREAM_FRAME_REGIONS, nullptr);
+
+	GLsizeiptr size = stream.regionSize * STREAM_FRAME_REGIONS;
+	glGenBuffers(1, &stream.buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, stream.buffer);
+	if (stream.persistent)
+	{
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+		stream.mapped = static_cast<uint8_t*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags));
+		if (stream.mapped == nullptr)
+		{
+			std::cerr << "Failed to map a streaming buffer of " << size << " bytes!" << std::endl;
+			return false;
+		}
+	}
+	else
+	{
+		glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	return true;
+}
+
+void DeleteStreamBuffer(GlStateCache& state, StreamBuffer& stream)
+{
+	for (GLsync& fence : stream.fences)
+	{
+		if (fence != nullptr)
+		{
+			glDeleteSync(fence);
+			fence = nullptr;
+		}
+	}
+	// deleting a mapped buffer unmaps it
+	if (stream.buffer != 0)
+	{
+		DeleteBuffer(state, stream.buffer);
+	}
+	stream.buffer = 0;
+	stream.mapped = nullptr;
+}
+
+void WaitForStreamFence(GLsync& fence)
+{
+	if (fence == nullptr)
+	{
+		return;
+	}
+	// only the first wait needs to flush, after that the fence is on its way
+	GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+	while (glClientWaitSync(fence, flags, STREAM_FENCE_TIMEOUT) == GL_TIMEOUT_EXPIRED)
+	{
+		flags = 0;
+	}
+	glDeleteSync(fence);
+	fence = nullptr;
+}
+
+void BeginStreamFrame(StreamBuffer& stream)
+{
+	stream.region = (stream.region + 1) % STREAM_FRAME_REGIONS;
+	stream.offset = 0;
+	WaitForStreamFence(stream.fences[stream.region]);
+	if (!stream.persistent && stream.region == 0)
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, stream.buffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, stream.regionSize * STREAM_FRAME_REGIONS, nullptr, GL_STREAM_DRAW);
+	}
+}
+
+void EndStreamFrame(StreamBuffer& stream)
+{
+	// orphaning already keeps the fallback's old contents alive for the GPU
+	if (stream.persistent)
+	{
+		stream.fences[stream.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+}
+
+GLintptr StreamData(GlStateCache& state, StreamBuffer& stream, const void* data, GLsizeiptr size)
+{
+	GLsizeiptr offset = (stream.offset + stream.alignment - 1) / stream.alignment * stream.alignment;
+	if (offset + size > stream.regionSize)
+	{
+		// anything written earlier this frame is still referenced in the old buffer, so only the first write may grow it
+		if (stream.offset > 0)
+		{
+			std::cerr << "Streaming buffer region of " << stream.regionSize << " bytes is full!" << std::endl;
+			return -1;
+		}
+		for (GLsync& fence : stream.fences)
+		{
+			WaitForStreamFence(fence);
+		}
+		GLsizeiptr alignment = stream.alignment;
+		GLsizeiptr regionSize = std::max(size, 2 * stream.regionSize);
+		DeleteStreamBuffer(state, stream);
+		if (!CreateStreamBuffer(stream, regionSize, alignment))
+		{
+			return -1;
+		}
+		offset = 0;
+	}
+
+	GLintptr bufferOffset = stream.region * stream.regionSize + offset;
+	if (size > 0)
+	{
+		if (stream.mapped != nullptr)
+		{
+			std::memcpy(stream.mapped + bufferOffset, data, size);
+		}
+		else
+		{
+			glBindBuffer(GL_COPY_WRITE_BUFFER, stream.buffer);
+			glBufferSubData(GL_COPY_WRITE_BUFFER, bufferOffset, size, data);
+		}
+	}
+	stream.offset = offset + size;
+	return bufferOffset;
+}
+
+bool StreamBufferRange(GlStateCache& state, StreamBuffer& stream, GLenum target, GLuint index, const void* data, GLsizeiptr size)
+{
+	GLintptr offset = StreamData(state, stream, data, size);
+	if (offset < 0)
+	{
+		return false;
+	}
+	BindBufferRange(state, target, index, stream.buffer, offset, size);
+	return true;
+}
+
+bool UpdateShadowQuality(ShadowQualityController& controller, const FrameProfiler& profiler, uint64_t frame)
+{
+	if (!controller.enabled)
+	{
+		return false;
+	}
+
+	// average of each pass over its newest samples at the current level, the local pass doesn't run every frame
+	// and the moments pass only with moment shadows
+	GLfloat milliseconds = 0.0f;
+	size_t cascadeSamples = 0;
+	for (ProfileSection section : { PROFILE_SHADOW_PASS, PROFILE_LOCAL_SHADOW_PASS, PROFILE_MOMENTS_PASS })
+	{
+		const std::deque<ProfileSample>& history = profiler.history[section];
+		GLfloat sum = 0.0f;
+		size_t count = 0;
+		for (auto sample = history.rbegin(); sample != history.rend() && sample->frame >= controller.levelFrame && count < SHADOW_QUALITY_SAMPLES; ++sample)
+		{
+			sum += sample->gpuMilliseconds;
+			count++;
+		}
+		if (count > 0)
+		{
+			milliseconds += sum / count;
+		}
+		if (section == PROFILE_SHADOW_PASS)
+		{
+			cascadeSamples = count;
+		}
+	}
+	if (cascadeSamples < SHADOW_QUALITY_SAMPLES)
+	{
+		return false;
+	}
+
+	int level = controller.level;
+	if (milliseconds > controller.budgetMilliseconds && level < SHADOW_QUALITY_LEVEL_COUNT - 1)
+	{
+		level++;
+	}
+	else if (milliseconds < controller.budgetMilliseconds * SHADOW_QUALITY_RAISE_THRESHOLD && level > 0)
+	{
+		level--;
+	}
+	if (level == controller.level)
+	{
+		return false;
+	}
+	controller.level = level;
+	controller.levelFrame = frame;
+	return true;
+}
+
+bool StartTextureLoader(TextureLoader& loader, const Scene& scene)
+{
+	GLuint layerCount = 1;
+	for (const Material& material : scene.materials)
+	{
+		layerCount = std::max(layerCount, material.textureLayer + 1);
+	}
+	loader.compressed = GLAD_GL_EXT_texture_compression_s3tc;
+
+	// every layer starts out white: a BC1 block with both endpoints white and every index on the first
+	glGenTextures(1, &loader.texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, loader.texture);
+	for (GLuint level = 0; level < MATERIAL_TEXTURE_LEVELS; level++)
+	{
+		GLsizei size = MATERIAL_TEXTURE_SIZE >> level;
+		if (loader.compressed)
+		{
+			const uint8_t whiteBlock[8] = { 0xff, 0xff, 0xff, 0xff, 0, 0, 0, 0 };
+			size_t blocks = size_t(std::max(1, size / 4)) * std::max(1, size / 4) * layerCount;
+			std::vector<uint8_t> white(blocks * sizeof(whiteBlock));
+			for (size_t i = 0; i < blocks; i++)
+			{
+				std::memcpy(&white[i * sizeof(whiteBlock)], whiteBlock, sizeof(whiteBlock));
+			}
+			glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, size, size, layerCount, 0,
+				static_cast<GLsizei>(white.size()), white.data());
+		}
+		else
+		{
+			std::vector<uint8_t> white(size_t(size) * size * 4 * layerCount, 0xff);
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, size, size, layerCount, 0, GL_RGBA, GL_UNSIGNED_BYTE, white.data());
+		}
+	}
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, MATERIAL_TEXTURE_LEVELS - 1);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	if (layerCount == 1)
+	{
+		return true;
+	}
+	// every chain is a multiple of four bytes, so the offsets need no padding and the budget is exact
+	if (!CreateStreamBuffer(loader.uploadStream, TEXTURE_UPLOAD_BUDGET, 4))
+	{
+		return false;
+	}
+	StartJobSystem(loader.jobs, TEXTURE_LOADER_THREADS);
+	std::vector<uint8_t> queued(layerCount, 0);
+	for (const Material& material : scene.materials)
+	{
+		if (material.textureLayer == 0 || queued[material.textureLayer])
+		{
+			continue;
+		}
+		queued[material.textureLayer] = 1;
+		std::string path = material.texture;
+		GLuint layer = material.textureLayer;
+		SubmitJob(loader.jobs, loader.pending, [&loader, path, layer]()
+		{
+			DecodedTexture texture;
+			texture.layer = layer;
+			if (DecodeMaterialTexture(path, loader.compressed, texture))
+			{
+				std::lock_guard<std::mutex> lock(loader.mutex);
+				loader.decoded.push_back(std::move(texture));
+			}
+		});
+	}
+	return true;
+}
+
+bool UploadLoadedTextures(TextureLoader& loader, GlStateCache& state)
+{
+	if (loader.uploadStream.buffer == 0)
+	{
+		return false;
+	}
+	// a job only stops counting after queueing its texture, so the count has to be read first
+	bool decoding = loader.pending.load(std::memory_order_acquire) > 0;
+	std::vector<DecodedTexture> ready;
+	GLsizeiptr readySize = 0;
+	{
+		std::lock_guard<std::mutex> lock(loader.mutex);
+		while (!loader.decoded.empty()
+			&& (ready.empty() || readySize + GLsizeiptr(loader.decoded.front().data.size()) <= loader.uploadStream.regionSize))
+		{
+			readySize += loader.decoded.front().data.size();
+			ready.push_back(std::move(loader.decoded.front()));
+			loader.decoded.pop_front();
+		}
+	}
+	if (ready.empty())
+	{
+		if (!decoding)
+		{
+			// the copies of the last textures may still be pending, GL keeps the buffer alive for them
+			DeleteStreamBuffer(state, loader.uploadStream);
+			return false;
+		}
+		return true;
+	}
+
+	BeginStreamFrame(loader.uploadStream);
+	BindTexture(state, MATERIAL_TEXTURE_UNIT, GL_TEXTURE_2D_ARRAY, loader.texture);
+	for (const DecodedTexture& texture : ready)
+	{
+		GLintptr offset = StreamData(state, loader.uploadStream, texture.data.data(), texture.data.size());
+		if (offset < 0)
+		{
+			continue;
+		}
+		// bound after streaming, growing the stream replaces its buffer
+		BindBuffer(state, GL_PIXEL_UNPACK_BUFFER, loader.uploadStream.buffer);
+		for (GLuint level = 0; level < MATERIAL_TEXTURE_LEVELS; level++)
+		{
+			GLsizei size = MATERIAL_TEXTURE_SIZE >> level;
+			const void* levelData = reinterpret_cast<const void*>(offset + texture.levelOffsets[level]);
+			if (loader.compressed)
+			{
+				GLsizei levelSize = static_cast<GLsizei>(texture.levelOffsets[level + 1] - texture.levelOffsets[level]);
+				glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, texture.layer, size, size, 1,
+					GL_COMPRESSED_RGB_S3TC_DXT1_EXT, levelSize, levelData);
+			}
+			else
+			{
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, texture.layer, size, size, 1, GL_RGBA, GL_UNSIGNED_BYTE, levelData);
+			}
+		}
+	}
+	// a bound unpack buffer would turn every later texture upload's pointer into an offset
+	BindBuffer(state, GL_PIXEL_UNPACK_BUFFER, 0);
+	EndStreamFrame(loader.uploadStream);
+	return true;
+}
+
+void StopTextureLoader(GlStateCache& state, TextureLoader& loader)
+{
+	StopJobSystem(loader.jobs);
+	DeleteStreamBuffer(state, loader.uploadStream);
+	glDeleteTextures(1, &loader.texture);
+}
+
+bool DecodeMaterialTexture(const std::string& path, bool compress, DecodedTexture& texture)
+{
+	int width, height, channels;
+	stbi_uc* pixels = stbi_load(path.c_str(), &width, &height, &channels, 4);
+	if (pixels == nullptr)
+	{
+		std::cerr << "Failed to load texture " << path << "!" << std::endl;
+		return false;
+	}
+	std::vector<uint8_t> level, next, blocks;
+	ResampleImage(pixels, width, height, MATERIAL_TEXTURE_SIZE, level);
+	stbi_image_free(pixels);
+
+	texture.data.clear();
+	GLuint size = MATERIAL_TEXTURE_SIZE;
+	for (GLuint i = 0; i < MATERIAL_TEXTURE_LEVELS; i++)
+	{
+		texture.levelOffsets[i] = texture.data.size();
+		if (compress)
+		{
+			EncodeBc1(level, size, blocks);
+			texture.data.insert(texture.data.end(), blocks.begin(), blocks.end());
+		}
+		else
+		{
+			texture.data.insert(texture.data.end(), level.begin(), level.end());
+		}
+		if (size > 1)
+		{
+			DownsampleImage(level, size, next);
+			level.swap(next);
+			size /= 2;
+		}
+	}
+	texture.levelOffsets[MATERIAL_TEXTURE_LEVELS] = texture.data.size();
+	return true;
+}
+
+void ResampleImage(const uint8_t* pixels, int width, int height, GLuint size, std::vector<uint8_t>& target)
+{
+	target.resize(size_t(size) * size * 4);
+	for (GLuint y = 0; y < size; y++)
+	{
+		// texel centers map onto texel centers
+		GLfloat sourceY = std::max(0.0f, (y + 0.5f) * height / size - 0.5f);
+		int y0 = std::min(static_cast<int>(sourceY), height - 1);
+		int y1 = std::min(y0 + 1, height - 1);
+		GLfloat fy = sourceY - y0;
+		for (GLuint x = 0; x < size; x++)
+		{
+			GLfloat sourceX = std::max(0.0f, (x + 0.5f) * width / size - 0.5f);
+			int x0 = std::min(static_cast<int>(sourceX), width - 1);
+			int x1 = std::min(x0 + 1, width - 1);
+			GLfloat fx = sourceX - x0;
+			for (int c = 0; c < 4; c++)
+			{
+				GLfloat top = pixels[(y0 * width + x0) * 4 + c] * (1.0f - fx) + pixels[(y0 * width + x1) * 4 + c] * fx;
+				GLfloat bottom = pixels[(y1 * width + x0) * 4 + c] * (1.0f - fx) + pixels[(y1 * width + x1) * 4 + c] * fx;
+				target[(size_t(y) * size + x) * 4 + c] = static_cast<uint8_t>(top * (1.0f - fy) + bottom * fy + 0.5f);
+			}
+		}
+	}
+}
+
+void DownsampleImage(const std::vector<uint8_t>& source, GLuint size, std::vector<uint8_t>& target)
+{
+	GLuint half = size / 2;
+	target.resize(size_t(half) * half * 4);
+	for (GLuint y = 0; y < half; y++)
+	{
+		for (GLuint x = 0; x < half; x++)
+		{
+			const uint8_t* row0 = &source[(size_t(2 * y) * size + 2 * x) * 4];
+			const uint8_t* row1 = row0 + size * 4;
+			for (int c = 0; c < 4; c++)
+			{
+				target[(size_t(y) * half + x) * 4 + c] = static_cast<uint8_t>((row0[c] + row0[4 + c] + row1[c] + row1[4 + c] + 2) / 4);
+			}
+		}
+	}
+}
+
+static uint16_t PackRgb565(const int* color)
+{
+	return static_cast<uint16_t>(((color[0] * 31 + 127) / 255) << 11 | ((color[1] * 63 + 127) / 255) << 5 | (color[2] * 31 + 127) / 255);
+}
+
+static void UnpackRgb565(uint16_t packed, int* color)
+{
+	int r = packed >> 11, g = (packed >> 5) & 0x3f, b = packed & 0x1f;
+	color[0] = (r << 3) | (r >> 2);
+	color[1] = (g << 2) | (g >> 4);
+	color[2] = (b << 3) | (b >> 2);
+}
+
+void EncodeBc1(const std::vector<uint8_t>& pixels, GLuint size, std::vector<uint8_t>& blocks)
+{
+	GLuint blocksWide = std::max(1u, size / 4);
+	blocks.resize(size_t(blocksWide) * blocksWide * 8);
+	for (GLuint blockY = 0; blockY < blocksWide; blockY++)
+	{
+		for (GLuint blockX = 0; blockX < blocksWide; blockX++)
+		{
+			// levels below 4x4 repeat their last row and column to fill the block
+			int texels[16][3];
+			int low[3] = { 255, 255, 255 }, high[3] = { 0, 0, 0 }, sum[3] = { 0, 0, 0 };
+			for (int i = 0; i < 16; i++)
+			{
+				GLuint x = std::min(blockX * 4 + i % 4, size - 1);
+				GLuint y = std::min(blockY * 4 + i / 4, size - 1);
+				for (int c = 0; c < 3; c++)
+				{
+					texels[i][c] = pixels[(size_t(y) * size + x) * 4 + c];
+					low[c] = std::min(low[c], texels[i][c]);
+					high[c] = std::max(high[c], texels[i][c]);
+					sum[c] += texels[i][c];
+				}
+			}
+
+			// the box has four diagonals, pick the one the texels lie along by the sign of each channel's
+			// covariance with the widest channel, so anti-correlated channels keep their hues
+			int widest = 0;
+			for (int c = 1; c < 3; c++)
+			{
+				if (high[c] - low[c] > high[widest] - low[widest])
+				{
+					widest = c;
+				}
+			}
+			bool flip[3] = { false, false, false };
+			for (int c = 0; c < 3; c++)
+			{
+				int covariance = 0;
+				for (int i = 0; i < 16; i++)
+				{
+					covariance += (16 * texels[i][c] - sum[c]) * (16 * texels[i][widest] - sum[widest]);
+				}
+				flip[c] = covariance < 0;
+			}
+			// pulling the endpoints in by a sixteenth of the range spends the palette on the bulk of the block
+			for (int c = 0; c < 3; c++)
+			{
+				int inset = (high[c] - low[c]) / 16;
+				low[c] += inset;
+				high[c] -= inset;
+				if (flip[c])
+				{
+					std::swap(low[c], high[c]);
+				}
+			}
+
+			// the four color mode needs color0 > color1, which holds in either order once swapped,
+			// unless both round to the same color, which index 0 alone reproduces
+			uint16_t color0 = PackRgb565(high), color1 = PackRgb565(low);
+			if (color0 < color1)
+			{
+				std::swap(color0, color1);
+			}
+			uint32_t indices = 0;
+			if (color0 != color1)
+			{
+				int palette[4][3];
+				UnpackRgb565(color0, palette[0]);
+				UnpackRgb565(color1, palette[1]);
+				for (int c = 0; c < 3; c++)
+				{
+					palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+					palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+				}
+				for (int i = 0; i < 16; i++)
+				{
+					int best = 0, bestDistance = INT32_MAX;
+					for (int entry = 0; entry < 4; entry++)
+					{
+						int distance = 0;
+						for (int c = 0; c < 3; c++)
+						{
+							int difference = texels[i][c] - palette[entry][c];
+							distance += difference * difference;
+						}
+						if (distance < bestDistance)
+						{
+							best = entry;
+							bestDistance = distance;
+						}
+					}
+					indices |= uint32_t(best) << (2 * i);
+				}
+			}
+
+			// little endian endpoints, then two bits per texel in row order
+			uint8_t* block = &blocks[(size_t(blockY) * blocksWide + blockX) * 8];
+			block[0] = color0 & 0xff;
+			block[1] = color0 >> 8;
+			block[2] = color1 & 0xff;
+			block[3] = color1 >> 8;
+			for (int i = 0; i < 4; i++)
+			{
+				block[4 + i] = (indices >> (8 * i)) & 0xff;
+			}
+		}
+	}
+}
+
+glm::mat4 ComputeStaticShadowWindow(const glm::mat4& cascadeViewProjection)
+{
+	// shrinking the cascade's NDC by a whole factor keeps its texel size, and its snap of the world origin to a texel corner
+	GLfloat scale = 1.0f / STATIC_SHADOW_CACHE_SCALE;
+	return glm::scale(glm::mat4(1.0f), glm::vec3(scale)) * cascadeViewProjection;
+}
+
+bool StaticShadowWindowCovers(const glm::mat4& windowViewProjection, const glm::mat4& cascadeViewProjection)
+{
+	// from cascade to window NDC is a uniform scale by 1 / STATIC_SHADOW_CACHE_SCALE plus a shift,
+	// a different radius or light direction changes the scale or adds a rotation
+	glm::mat4 cascadeToWindow = windowViewProjection * glm::inverse(cascadeViewProjection);
+	for (int column = 0; column < 3; column++)
+	{
+		for (int row = 0; row < 3; row++)
+		{
+			GLfloat expected = row == column ? 1.0f / STATIC_SHADOW_CACHE_SCALE : 0.0f;
+			if (std::abs(cascadeToWindow[column][row] - expected) > 1e-4f)
+			{
+				return false;
+			}
+		}
+	}
+	for (int corner = 0; corner < 8; corner++)
+	{
+		glm::vec4 ndc(corner & 1 ? 1.0f : -1.0f, corner & 2 ? 1.0f : -1.0f, corner & 4 ? 1.0f : -1.0f, 1.0f);
+		glm::vec4 window = cascadeToWindow * ndc;
+		if (std::abs(window.x) > 1.0f || std::abs(window.y) > 1.0f || std::abs(window.z) > 1.0f)
+		{
+			return false;
+		}
+	}
+	return true;
 }
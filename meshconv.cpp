@@ -0,0 +1,311 @@
+// Offline converter from Wavefront OBJ to the binary .mesh format in meshformat.h.
+// usage: meshconv [--compact] input.obj output.mesh
+//
+// Supports "v x y z [r g b]" (colors in 0..1), "vn" and polygonal "f" lines with
+// v, v/vt, v//vn or v/vt/vn references. Polygons are triangulated as fans and
+// identical position/normal pairs are merged into one vertex. Faces without normals
+// get the normal of their first triangle, clockwise winding facing out like the repo's meshes.
+// Positions and the other attributes are written as separate streams, --compact
+// stores them as half floats and packed colors and normals.
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "meshformat.h"
+
+struct ObjPosition
+{
+	float x, y, z;
+	float r, g, b;
+};
+
+struct ObjNormal
+{
+	float x, y, z;
+};
+
+// full precision vertex, split into the output layout's streams when writing
+struct Vertex
+{
+	float x, y, z;
+	uint8_t r, g, b;
+	float nx, ny, nz;
+};
+
+// resolves a 1-based or negative (relative) OBJ index, returns -1 when out of range
+int ResolveObjIndex(int index, size_t count)
+{
+	int resolved = index > 0 ? index - 1 : static_cast<int>(count) + index;
+	return resolved >= 0 && resolved < static_cast<int>(count) ? resolved : -1;
+}
+
+// IEEE 754 binary16 with round to nearest even, overflow becomes infinity
+uint16_t FloatToHalf(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint32_t sign = (bits >> 16) & 0x8000;
+	int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = bits & 0x7FFFFF;
+
+	if (((bits >> 23) & 0xFF) == 0xFF)
+	{
+		// infinity stays infinity, NaN stays a quiet NaN
+		return static_cast<uint16_t>(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+	}
+	if (exponent >= 31)
+	{
+		return static_cast<uint16_t>(sign | 0x7C00);
+	}
+	if (exponent <= 0)
+	{
+		// subnormal or zero, shift the implicit bit in and round
+		if (exponent < -10)
+		{
+			return static_cast<uint16_t>(sign);
+		}
+		mantissa |= 0x800000;
+		uint32_t shift = static_cast<uint32_t>(14 - exponent);
+		uint32_t half = mantissa >> shift;
+		uint32_t remainder = mantissa & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+		if (remainder > halfway || (remainder == halfway && (half & 1)))
+		{
+			half++;
+		}
+		return static_cast<uint16_t>(sign | half);
+	}
+
+	uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+	uint32_t remainder = mantissa & 0x1FFF;
+	// a carry out of the mantissa correctly bumps the exponent
+	if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+	{
+		half++;
+	}
+	return static_cast<uint16_t>(half);
+}
+
+// packs a unit vector as signed normalized 10:10:10 with w = 0
+uint32_t PackNormal(float x, float y, float z)
+{
+	auto component = [](float value)
+	{
+		long quantized = std::lround(std::fmin(std::fmax(value, -1.0f), 1.0f) * 511.0f);
+		return static_cast<uint32_t>(quantized) & 0x3FF;
+	};
+	return component(x) | (component(y) << 10) | (component(z) << 20);
+}
+
+int main(int argc, char** argv)
+{
+	bool compact = argc == 4 && strcmp(argv[1], "--compact") == 0;
+	if (argc != 3 && !compact)
+	{
+		std::cerr << "usage: meshconv [--compact] input.obj output.mesh" << std::endl;
+		return 1;
+	}
+	const char* inputPath = argv[argc - 2];
+	const char* outputPath = argv[argc - 1];
+
+	std::ifstream input(inputPath);
+	if (!input)
+	{
+		std::cerr << "Failed to open " << inputPath << std::endl;
+		return 1;
+	}
+
+	std::vector<ObjPosition> positions;
+	std::vector<ObjNormal> normals;
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	// (position, normal) pair -> output vertex
+	std::unordered_map<uint64_t, uint32_t> vertexLookup;
+
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(input, line))
+	{
+		lineNumber++;
+		std::istringstream words(line.substr(0, line.find('#')));
+		std::string keyword;
+		if (!(words >> keyword))
+		{
+			continue;
+		}
+
+		if (keyword == "v")
+		{
+			ObjPosition position = { 0, 0, 0, 1, 1, 1 };
+			if (!(words >> position.x >> position.y >> position.z))
+			{
+				std::cerr << inputPath << ":" << lineNumber << ": malformed vertex" << std::endl;
+				return 1;
+			}
+			words >> position.r >> position.g >> position.b;
+			positions.push_back(position);
+		}
+		else if (keyword == "vn")
+		{
+			ObjNormal normal;
+			if (!(words >> normal.x >> normal.y >> normal.z))
+			{
+				std::cerr << inputPath << ":" << lineNumber << ": malformed normal" << std::endl;
+				return 1;
+			}
+			normals.push_back(normal);
+		}
+		else if (keyword == "f")
+		{
+			std::vector<uint32_t> polygon;
+			// vertices of this face that still need a generated normal
+			std::vector<uint32_t> missingNormals;
+			std::string reference;
+			while (words >> reference)
+			{
+				int positionIndex = 0, texcoordIndex = 0, normalIndex = 0;
+				if (sscanf(reference.c_str(), "%d/%d/%d", &positionIndex, &texcoordIndex, &normalIndex) != 3 &&
+					sscanf(reference.c_str(), "%d//%d", &positionIndex, &normalIndex) != 2)
+				{
+					normalIndex = 0;
+					sscanf(reference.c_str(), "%d", &positionIndex);
+				}
+				int position = ResolveObjIndex(positionIndex, positions.size());
+				int normal = normalIndex != 0 ? ResolveObjIndex(normalIndex, normals.size()) : -1;
+				if (position < 0 || (normalIndex != 0 && normal < 0))
+				{
+					std::cerr << inputPath << ":" << lineNumber << ": face refers to a missing vertex or normal" << std::endl;
+					return 1;
+				}
+
+				// faces without normals never share vertices, their normal is filled in per face below
+				uint64_t key = (static_cast<uint64_t>(position) << 32) | static_cast<uint32_t>(normal);
+				auto found = normal >= 0 ? vertexLookup.find(key) : vertexLookup.end();
+				if (found != vertexLookup.end())
+				{
+					polygon.push_back(found->second);
+					continue;
+				}
+
+				const ObjPosition& p = positions[position];
+				Vertex vertex = {};
+				vertex.x = p.x;
+				vertex.y = p.y;
+				vertex.z = p.z;
+				vertex.r = static_cast<uint8_t>(std::lround(std::fmin(std::fmax(p.r, 0.0f), 1.0f) * 255.0f));
+				vertex.g = static_cast<uint8_t>(std::lround(std::fmin(std::fmax(p.g, 0.0f), 1.0f) * 255.0f));
+				vertex.b = static_cast<uint8_t>(std::lround(std::fmin(std::fmax(p.b, 0.0f), 1.0f) * 255.0f));
+				if (normal >= 0)
+				{
+					vertex.nx = normals[normal].x;
+					vertex.ny = normals[normal].y;
+					vertex.nz = normals[normal].z;
+					vertexLookup[key] = static_cast<uint32_t>(vertices.size());
+				}
+				else
+				{
+					missingNormals.push_back(static_cast<uint32_t>(vertices.size()));
+				}
+				polygon.push_back(static_cast<uint32_t>(vertices.size()));
+				vertices.push_back(vertex);
+			}
+
+			if (polygon.size() < 3)
+			{
+				std::cerr << inputPath << ":" << lineNumber << ": face with fewer than 3 vertices" << std::endl;
+				return 1;
+			}
+
+			if (!missingNormals.empty())
+			{
+				const Vertex& a = vertices[polygon[0]];
+				const Vertex& b = vertices[polygon[1]];
+				const Vertex& c = vertices[polygon[2]];
+				float ux = b.x - a.x, uy = b.y - a.y, uz = b.z - a.z;
+				float vx = c.x - a.x, vy = c.y - a.y, vz = c.z - a.z;
+				// v x u, the front side of a clockwise triangle
+				float nx = vy * uz - vz * uy, ny = vz * ux - vx * uz, nz = vx * uy - vy * ux;
+				float length = std::sqrt(nx * nx + ny * ny + nz * nz);
+				for (uint32_t index : missingNormals)
+				{
+					vertices[index].nx = length > 0 ? nx / length : 0;
+					vertices[index].ny = length > 0 ? ny / length : 0;
+					vertices[index].nz = length > 0 ? nz / length : 0;
+				}
+			}
+
+			for (size_t i = 1; i + 1 < polygon.size(); i++)
+			{
+				indices.push_back(polygon[0]);
+				indices.push_back(polygon[i]);
+				indices.push_back(polygon[i + 1]);
+			}
+		}
+		// texture coordinates, groups, materials and smoothing groups are not used by the renderer
+	}
+
+	MeshFileHeader header = {};
+	memcpy(header.magic, MESH_FILE_MAGIC, sizeof(header.magic));
+	header.version = MESH_FILE_VERSION;
+	header.layout = compact ? MESH_LAYOUT_COMPACT : MESH_LAYOUT_STANDARD;
+	header.positionSize = compact ? sizeof(CompactPosition) : sizeof(StandardPosition);
+	header.attributeSize = compact ? sizeof(CompactAttributes) : sizeof(StandardAttributes);
+	header.vertexCount = static_cast<uint32_t>(vertices.size());
+	header.indexCount = static_cast<uint32_t>(indices.size());
+	header.positionOffset = sizeof(MeshFileHeader);
+	header.attributeOffset = header.positionOffset + header.vertexCount * header.positionSize;
+	header.indexOffset = header.attributeOffset + header.vertexCount * header.attributeSize;
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		const float position[3] = { vertices[i].x, vertices[i].y, vertices[i].z };
+		for (int axis = 0; axis < 3; axis++)
+		{
+			header.boundsMin[axis] = i == 0 ? position[axis] : std::fmin(header.boundsMin[axis], position[axis]);
+			header.boundsMax[axis] = i == 0 ? position[axis] : std::fmax(header.boundsMax[axis], position[axis]);
+		}
+	}
+
+	std::ofstream output(outputPath, std::ios::binary);
+	output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	if (compact)
+	{
+		std::vector<CompactPosition> positionStream(vertices.size());
+		std::vector<CompactAttributes> attributeStream(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			const Vertex& vertex = vertices[i];
+			positionStream[i] = { FloatToHalf(vertex.x), FloatToHalf(vertex.y), FloatToHalf(vertex.z), 0 };
+			attributeStream[i] = { vertex.r, vertex.g, vertex.b, 255, PackNormal(vertex.nx, vertex.ny, vertex.nz) };
+		}
+		output.write(reinterpret_cast<const char*>(positionStream.data()), positionStream.size() * sizeof(CompactPosition));
+		output.write(reinterpret_cast<const char*>(attributeStream.data()), attributeStream.size() * sizeof(CompactAttributes));
+	}
+	else
+	{
+		std::vector<StandardPosition> positionStream(vertices.size());
+		std::vector<StandardAttributes> attributeStream(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			const Vertex& vertex = vertices[i];
+			positionStream[i] = { vertex.x, vertex.y, vertex.z };
+			attributeStream[i] = { vertex.r, vertex.g, vertex.b, 0, vertex.nx, vertex.ny, vertex.nz };
+		}
+		output.write(reinterpret_cast<const char*>(positionStream.data()), positionStream.size() * sizeof(StandardPosition));
+		output.write(reinterpret_cast<const char*>(attributeStream.data()), attributeStream.size() * sizeof(StandardAttributes));
+	}
+	output.write(reinterpret_cast<const char*>(indices.data()), indices.size() * sizeof(uint32_t));
+	if (!output)
+	{
+		std::cerr << "Failed to write " << outputPath << std::endl;
+		return 1;
+	}
+
+	std::cout << outputPath << ": " << header.vertexCount << " vertices, " << header.indexCount / 3 << " triangles" << std::endl;
+	return 0;
+}
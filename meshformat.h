@@ -0,0 +1,63 @@
+// Binary mesh format written by meshconv.cpp and memory-mapped by main.cpp.
+// The vertex and index blocks are laid out exactly as the GL buffers expect them,
+// so loading is a bounds check followed by glBufferData straight from the mapping.
+#pragma once
+
+#include <cstdint>
+
+// Both layouts store positions and the remaining attributes in separate streams,
+// so the depth pass only fetches positions. Each matches the attribute pointers set up in main.cpp.
+
+// standard layout, 12 + 16 bytes
+struct StandardPosition
+{
+	float x, y, z;
+};
+
+struct StandardAttributes
+{
+	uint8_t r, g, b;		// Color
+	uint8_t padding;
+	float nx, ny, nz;		// Normals
+};
+
+// compact layout, 8 + 8 bytes
+struct CompactPosition
+{
+	uint16_t x, y, z;	// half floats
+	uint16_t padding;
+};
+
+struct CompactAttributes
+{
+	uint8_t r, g, b, a;	// RGBA8 color
+	uint32_t normal;	// signed normalized GL_INT_2_10_10_10_REV, x in the low bits
+};
+
+enum MeshLayout : uint32_t
+{
+	MESH_LAYOUT_STANDARD = 0,	// StandardPosition stream followed by a StandardAttributes stream
+	MESH_LAYOUT_COMPACT = 1		// CompactPosition stream followed by a CompactAttributes stream
+};
+
+const char MESH_FILE_MAGIC[4] = { 'M', 'E', 'S', 'H' };
+// bump whenever a vertex struct or the header changes, old files are then rejected
+const uint32_t MESH_FILE_VERSION = 4;
+
+// file layout: header, vertexCount positions at positionOffset, vertexCount attributes at attributeOffset
+// and indexCount uint32 indices at indexOffset
+struct MeshFileHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t layout;		// MeshLayout
+	uint32_t positionSize;	// stride of each stream, for checking against the reader's structs
+	uint32_t attributeSize;
+	uint32_t vertexCount;
+	uint32_t indexCount;	// triangle list
+	uint32_t positionOffset;	// byte offsets from the start of the file, 4-byte aligned
+	uint32_t attributeOffset;
+	uint32_t indexOffset;
+	float boundsMin[3];		// local space bounding box, used for culling
+	float boundsMax[3];
+};